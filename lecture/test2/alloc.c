@@ -1,403 +1,2042 @@
 #define _DEFAULT_SOURCE
 #include "alloc.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
-static int limit = 0;
-static enum algs algs = FIRST_FIT;
-static struct header *head = NULL; // first block (our region)
-static void *heap_origin = NULL;   // where heap starts
-static void *heap_end = NULL;
-static bool deallocCalled = false;
-
-void coalesce_unsorted(void) {
-  bool merged;
-  do {
-    merged = false;
-    struct header *a = head;
-    struct header *prev = NULL;
-
-    while (a != NULL) {
-      struct header *b = head;
-      struct header *b_prev = NULL;
-
-      while (b != NULL) {
-        if (a != b) {
-          // Forward merge: a immediately before b
-          if ((char *)a + sizeof(struct header) + a->size ==
-              (char *)b + sizeof(struct header)) {
-            printf("[coalesce] Merging forward: %p(size=%lu) + %p(size=%lu)\n",
-                   a, a->size, b, b->size);
-
-            a->size += b->size;
-
-            if (b_prev)
-              b_prev->next = b->next;
-            else
-              head = b->next;
-
-            merged = true;
-            break; // restart after merge
-          }
-
-          // Backward merge: b immediately before a
-          if ((char *)b + sizeof(struct header) + b->size ==
-              (char *)a + sizeof(struct header)) {
-            printf("[coalesce] Merging backward: %p(size=%lu) + %p(size=%lu)\n",
-                   b, b->size, a, a->size);
-
-            b->size += a->size;
-
-            if (prev)
-              prev->next = a->next;
-            else
-              head = a->next;
-
-            merged = true;
-            break; // restart after merge
-          }
-        }
-
-        b_prev = b;
-        b = b->next;
-      }
+#define HEADER_SIZE sizeof(struct header)
+// A split only leaves a free chunk behind if it can hold a header and some
+// space; smaller remainders stay with the allocated block
+#define MIN_SPLIT (HEADER_SIZE * 2)
+// Free chunks are kept in one list per power-of-two size class:
+// class c holds the chunks of size [16 << c, 32 << c)
+#define CLASS_COUNT 32
+// Set in the size of free chunks; allocated blocks keep their plain size
+#define FREE_BIT (1ULL << 63)
+// Set in the size of blocks that have a mapping of their own
+#define MMAP_BIT (1ULL << 62)
 
-      if (merged)
-        break; // restart from head
-      prev = a;
-      a = a->next;
-    }
-  } while (merged);
+// ALLOC_TRACE_LEVEL 2 logs every block the heap hands out or takes back
+#if ALLOC_TRACE_LEVEL >= 2
+#define TRACE_PRINT(...) printf(__VA_ARGS__)
+#else
+#define TRACE_PRINT(...) ((void)0)
+#endif
+
+// Node of the size tree, kept in the payload of a free chunk
+struct node {
+  struct header *left;
+  struct header *right;
+  struct header *parent;
+};
+
+#define NODE(chunk) ((struct node *)((chunk) + 1))
+#define TREE_MIN (HEADER_SIZE + sizeof(struct node))
+#define SMALL_COUNT (TREE_MIN - HEADER_SIZE)
+
+// Levels of the segregated lists
+#define TLSF_SL_BITS 4
+#define TLSF_SL (1 << TLSF_SL_BITS)
+#define TLSF_FL 48 // sizes from 16 up to 2^52
+
+// Each mmap'd segment of a heap starts with this header
+struct segment {
+  struct segment *next;
+  uint64_t size; // whole mapping
+};
+
+// Freed blocks with payloads of [8, QUICK_COUNT) bytes can wait in the
+// quick lists
+#define QUICK_COUNT 512
+
+#define SEGMENT_MIN (64 * 1024)
+#define SEGMENT_MAX (64 * 1024 * 1024)
+
+// Every block starts with a header whose size is the size of the whole
+// block, header included.
+//
+// Boundary tags: an allocated block does not use its next field, so it holds
+// the back link of the free chunk right before it, that is the link that
+// points to that chunk in the free chunk index, or NULL if the block before
+// is allocated. Free chunks are always merged with their free neighbours, so
+// the block after a free chunk is allocated or the end of the heap, and
+// top_back holds the back link of a free chunk at the top. This finds and
+// unlinks both neighbours of a block in constant time, whatever the chunk
+// size.
+//
+// All the state of one heap: alloc() and the rest use main_heap, and each
+// arena handle is a heap of its own.
+struct heap {
+  int limit;
+  enum algs algs;
+  struct header **top_back; // back link of a free top chunk
+  void *origin;             // where heap starts
+  void *end;                // current end of our heap
+  uint64_t free_total;      // bytes in free chunks, headers included
+  uint64_t free_count;      // number of free chunks
+  struct allocstats stats;  // see allocstats()
+
+  // FIRST_FIT: free chunks of each size class
+  struct header *bins[CLASS_COUNT];
+  uint32_t bin_map; // bit c is set if bins[c] is not empty
+
+  // BEST_FIT, WORST_FIT: size tree and free chunks of size 16 + i
+  struct header *root;
+  struct header *small[SMALL_COUNT];
+  uint32_t small_map; // bit i is set if small[i] is not empty
+
+  // TLSF: segregated lists
+  struct header *tlsf[TLSF_FL][TLSF_SL];
+  uint64_t tlsf_fl_map;          // bit f is set if tlsf_sl_map[f] != 0
+  uint32_t tlsf_sl_map[TLSF_FL]; // bit s is set if tlsf[f][s] is not empty
+
+  // ALLOC_LINEAR: every free chunk, newest first
+  bool linear;
+  struct header *list;
+
+  // ALLOC_DENSE: sizes and chunks, in no order; the list takes the rest
+  bool dense;
+  int32_t *dense_sizes;
+  struct header **dense_chunks;
+  size_t dense_count;
+  size_t dense_cap;
+
+  // Settings of the heap: the main heap follows allocparam(), an arena
+  // keeps the ones it was created with
+  uint64_t defer_limit;    // quick list blocks per merge, 0 = off
+  uint64_t trim_threshold; // free chunk size to trim at, 0 = off
+  bool checked;            // blocks have guards, see CHECKS
+
+  // ALLOC_DEFER: freed blocks not merged yet, by payload size
+  struct header *quick[QUICK_COUNT];
+  uint64_t quick_map[QUICK_COUNT / 64]; // bit i is set if quick[i] is not
+                                        // empty
+  uint64_t quick_count;                 // blocks in the quick lists
+
+  bool use_segments; // grow by mmap'd segments instead of the break
+  struct segment *segments;
+  uint64_t segment_total; // bytes mapped for segments
+  uint64_t segment_next;  // size of the next segment
+};
+
+static struct heap main_heap = {.algs = FIRST_FIT,
+                                .segment_next = SEGMENT_MIN};
+
+static uint64_t chunk_size(const struct header *chunk) {
+  return chunk->size & ~FREE_BIT;
+}
+
+// Histogram bucket of a size: bucket b holds [2^b, 2^(b+1))
+static size_t hist_bucket(uint64_t size) {
+  size_t b = size ? 63 - __builtin_clzll(size) : 0;
+  return b < ALLOC_HIST_BUCKETS ? b : ALLOC_HIST_BUCKETS - 1;
+}
+
+// -----------------------------
+// BOUNDARY TAGS
+// -----------------------------
+// Back link of a free chunk
+static struct header **get_back(struct heap *h, struct header *chunk) {
+  struct header *end = (struct header *)((char *)chunk + chunk_size(chunk));
+  return end == h->end ? h->top_back : (struct header **)end->next;
+}
+
+static void set_back(struct heap *h, struct header *chunk,
+                     struct header **link) {
+  struct header *end = (struct header *)((char *)chunk + chunk_size(chunk));
+  if (end == h->end)
+    h->top_back = link;
+  else
+    end->next = (struct header *)link;
 }
 
-struct header *get_last(struct header *block) {
-  struct header *temp = head;
-  struct header *last = NULL;
-  while (temp != NULL) {
-    if (temp == block) {
-      //      printf("get_last returning: %p\n", last);
-      return last;
+// Pushes a free chunk on a LIFO list linked through next
+static void list_push(struct heap *h, struct header **list,
+                      struct header *chunk) {
+  chunk->next = *list;
+  if (chunk->next)
+    set_back(h, chunk->next, &chunk->next);
+  *list = chunk;
+  set_back(h, chunk, list);
+}
+
+static void list_take(struct heap *h, struct header *chunk) {
+  struct header **link = get_back(h, chunk);
+  *link = chunk->next;
+  if (chunk->next)
+    set_back(h, chunk->next, link);
+  chunk->next = NULL;
+}
+
+// -----------------------------
+// SIZE CLASSES (FIRST_FIT)
+// -----------------------------
+static size_t size_class(uint64_t size) {
+  size_t c = 63 - __builtin_clzll(size) - 4;
+  return c < CLASS_COUNT ? c : CLASS_COUNT - 1;
+}
+
+// Non-empty classes from c up
+static uint32_t bins_from(struct heap *h, size_t c) {
+  return h->bin_map & ~((1U << c) - 1);
+}
+
+static void bin_push(struct heap *h, struct header *chunk) {
+  size_t c = size_class(chunk_size(chunk));
+  list_push(h, &h->bins[c], chunk);
+  h->bin_map |= 1U << c;
+}
+
+static void bin_take(struct heap *h, struct header *chunk) {
+  size_t c = size_class(chunk_size(chunk));
+  list_take(h, chunk);
+  if (h->bins[c] == NULL)
+    h->bin_map &= ~(1U << c);
+}
+
+// Classes above the request's own class only hold chunks that fit
+struct header *find_first_fit(struct heap *h, uint64_t size) {
+  for (uint32_t map = bins_from(h, size_class(size)); map; map &= map - 1) {
+    for (struct header *chunk = h->bins[__builtin_ctz(map)]; chunk != NULL;
+         chunk = chunk->next) {
+      if (chunk_size(chunk) >= size)
+        return chunk;
     }
-    last = temp;
-    temp = temp->next;
   }
   return NULL;
 }
 
-struct header *find_first_fit(struct header *free_list_ptr, uint64_t size) {
-  while (free_list_ptr != NULL) {
-    if (free_list_ptr->size >= size) {
-      return free_list_ptr;
-    }
-    free_list_ptr = free_list_ptr->next;
+// -----------------------------
+// SIZE TREE (BEST_FIT, WORST_FIT)
+// -----------------------------
+// Chunks that can hold a node are kept in a treap ordered by size, then by
+// address, so equal sizes are handed out lowest address first. The node
+// lives in the chunk's payload, and the links to a node are its back links.
+// Smaller chunks go in one LIFO list per exact size.
+
+// Heap order of the treap: a hash of the address stands in for a random
+// priority, so nothing has to be stored for it
+static uint64_t priority(const struct header *chunk) {
+  return (uintptr_t)chunk * 0x9e3779b97f4a7c15ULL;
+}
+
+static bool tree_less(const struct header *a, const struct header *b) {
+  return chunk_size(a) < chunk_size(b) ||
+         (chunk_size(a) == chunk_size(b) && a < b);
+}
+
+static struct header **child_link(struct heap *h, struct header *parent,
+                                  struct header *chunk) {
+  if (parent == NULL)
+    return &h->root;
+  return NODE(parent)->left == chunk ? &NODE(parent)->left
+                                     : &NODE(parent)->right;
+}
+
+// Points *link at chunk, a child of parent
+static void tree_set(struct heap *h, struct header **link,
+                     struct header *chunk, struct header *parent) {
+  *link = chunk;
+  if (chunk) {
+    NODE(chunk)->parent = parent;
+    set_back(h, chunk, link);
   }
-  return NULL;
 }
-struct header *get_next(struct header *free_list_ptr, struct header *block) {
-  while (free_list_ptr != NULL) {
-    if (free_list_ptr == block) {
-      return free_list_ptr->next;
-    }
-    free_list_ptr = free_list_ptr->next;
+
+// Rotates chunk above its parent
+static void rotate_up(struct heap *h, struct header *chunk) {
+  struct header *parent = NODE(chunk)->parent;
+  struct header *grand = NODE(parent)->parent;
+  struct header **link = child_link(h, grand, parent);
+  if (NODE(parent)->left == chunk) {
+    tree_set(h, &NODE(parent)->left, NODE(chunk)->right, parent);
+    tree_set(h, &NODE(chunk)->right, parent, chunk);
+  } else {
+    tree_set(h, &NODE(parent)->right, NODE(chunk)->left, parent);
+    tree_set(h, &NODE(chunk)->left, parent, chunk);
   }
-  return NULL;
+  tree_set(h, link, chunk, grand);
+}
+
+static void tree_insert(struct heap *h, struct header *chunk) {
+  struct header *parent = NULL;
+  struct header **link = &h->root;
+  while (*link) {
+    parent = *link;
+    link = tree_less(chunk, parent) ? &NODE(parent)->left
+                                    : &NODE(parent)->right;
+  }
+  NODE(chunk)->left = NODE(chunk)->right = NULL;
+  tree_set(h, link, chunk, parent);
+  while (NODE(chunk)->parent &&
+         priority(NODE(chunk)->parent) < priority(chunk))
+    rotate_up(h, chunk);
+}
+
+static void tree_remove(struct heap *h, struct header *chunk) {
+  // Rotate the chunk down until it has at most one child
+  while (NODE(chunk)->left && NODE(chunk)->right) {
+    struct header *l = NODE(chunk)->left;
+    struct header *r = NODE(chunk)->right;
+    rotate_up(h, priority(l) > priority(r) ? l : r);
+  }
+  struct header *child =
+      NODE(chunk)->left ? NODE(chunk)->left : NODE(chunk)->right;
+  struct header *parent = NODE(chunk)->parent;
+  tree_set(h, child_link(h, parent, chunk), child, parent);
+}
+
+static struct header *tree_min(struct heap *h) {
+  struct header *chunk = h->root;
+  while (chunk && NODE(chunk)->left)
+    chunk = NODE(chunk)->left;
+  return chunk;
+}
+
+static struct header *tree_max(struct heap *h) {
+  struct header *chunk = h->root;
+  while (chunk && NODE(chunk)->right)
+    chunk = NODE(chunk)->right;
+  return chunk;
+}
+
+static void small_push(struct heap *h, struct header *chunk) {
+  size_t i = chunk_size(chunk) - HEADER_SIZE;
+  list_push(h, &h->small[i], chunk);
+  h->small_map |= 1U << i;
 }
-struct header *find_best_fit(struct header *free_list_ptr, uint64_t size) {
+
+static void small_take(struct heap *h, struct header *chunk) {
+  size_t i = chunk_size(chunk) - HEADER_SIZE;
+  list_take(h, chunk);
+  if (h->small[i] == NULL)
+    h->small_map &= ~(1U << i);
+}
+
+struct header *find_best_fit(struct heap *h, uint64_t size) {
+  if (size < TREE_MIN) {
+    uint32_t map = h->small_map & ~((1U << (size - HEADER_SIZE)) - 1);
+    if (map)
+      return h->small[__builtin_ctz(map)];
+  }
+  // Smallest chunk that is at least size
   struct header *best_fit = NULL;
-  uint64_t best_fit_size = UINT64_MAX;
-  while (free_list_ptr != NULL) {
-    if (free_list_ptr->size >= size && free_list_ptr->size < best_fit_size) {
-      best_fit_size = free_list_ptr->size;
-      best_fit = free_list_ptr;
+  for (struct header *chunk = h->root; chunk != NULL;) {
+    if (chunk_size(chunk) >= size) {
+      best_fit = chunk;
+      chunk = NODE(chunk)->left;
+    } else {
+      chunk = NODE(chunk)->right;
     }
-    free_list_ptr = free_list_ptr->next;
   }
   return best_fit;
 }
-struct header *find_worst_fit(struct header *free_list_ptr, uint64_t size) {
-  struct header *worst_fit = NULL;
-  uint64_t worst_fit_size = 0;
-  while (free_list_ptr != NULL) {
-    if (free_list_ptr->size >= size && free_list_ptr->size > worst_fit_size) {
-      worst_fit_size = free_list_ptr->size;
-      worst_fit = free_list_ptr;
+
+struct header *find_worst_fit(struct heap *h, uint64_t size) {
+  struct header *worst_fit = tree_max(h);
+  if (worst_fit == NULL && h->small_map)
+    worst_fit = h->small[31 - __builtin_clz(h->small_map)];
+  return worst_fit && chunk_size(worst_fit) >= size ? worst_fit : NULL;
+}
+
+// -----------------------------
+// SEGREGATED FIT (TLSF)
+// -----------------------------
+// Two-level segregated fit: the first level splits sizes at powers of two,
+// the second splits each power of two into TLSF_SL equal ranges, and a
+// bitmap per level finds the first non-empty list in one instruction.
+// Requests are rounded up to the next range, so the head of any list found
+// fits: finding, taking and giving back a chunk take a bounded number of
+// steps, whatever is in the heap.
+
+// List of a size: f is the power of two below it, s the range within it
+static void tlsf_index(uint64_t size, size_t *f, size_t *s) {
+  size_t fl = 63 - __builtin_clzll(size);
+  *f = fl - TLSF_SL_BITS;
+  *s = (size >> (fl - TLSF_SL_BITS)) & (TLSF_SL - 1);
+  if (*f >= TLSF_FL) {
+    *f = TLSF_FL - 1;
+    *s = TLSF_SL - 1;
+  }
+}
+
+static void tlsf_push(struct heap *h, struct header *chunk) {
+  size_t f, s;
+  tlsf_index(chunk_size(chunk), &f, &s);
+  list_push(h, &h->tlsf[f][s], chunk);
+  h->tlsf_sl_map[f] |= 1U << s;
+  h->tlsf_fl_map |= 1ULL << f;
+}
+
+static void tlsf_take(struct heap *h, struct header *chunk) {
+  size_t f, s;
+  tlsf_index(chunk_size(chunk), &f, &s);
+  list_take(h, chunk);
+  if (h->tlsf[f][s] == NULL) {
+    h->tlsf_sl_map[f] &= ~(1U << s);
+    if (h->tlsf_sl_map[f] == 0)
+      h->tlsf_fl_map &= ~(1ULL << f);
+  }
+}
+
+struct header *find_tlsf_fit(struct heap *h, uint64_t size) {
+  size_t f, s;
+  size_t fl = 63 - __builtin_clzll(size);
+  tlsf_index(size + (1ULL << (fl - TLSF_SL_BITS)) - 1, &f, &s);
+  uint32_t sl = h->tlsf_sl_map[f] & (~0U << s);
+  if (sl == 0 && f + 1 < TLSF_FL) {
+    uint64_t fm = h->tlsf_fl_map & (~0ULL << (f + 1));
+    if (fm) {
+      f = __builtin_ctzll(fm);
+      sl = h->tlsf_sl_map[f];
     }
-    free_list_ptr = free_list_ptr->next;
   }
-  return worst_fit;
+  if (sl)
+    return h->tlsf[f][__builtin_ctz(sl)];
+  // Nothing in a bigger range: the head of the request's own list may fit
+  tlsf_index(size, &f, &s);
+  struct header *chunk = h->tlsf[f][s];
+  return chunk && chunk_size(chunk) >= size ? chunk : NULL;
 }
 
-void *alloc(int size) {
-  if (deallocCalled == false) {
-    if (head == NULL) {
-      void *mem = sbrk(INCREMENT);
-      if (mem == (void *)-1) {
-        perror("sbrk failed");
-        return NULL;
-      }
+// -----------------------------
+// LINEAR LIST
+// -----------------------------
+// ALLOC_LINEAR keeps every free chunk in one LIFO list and scans all of it
+// with the policy's rule, the way alloc2.c did. The scan is as long as the
+// list, so this is the baseline the indexes above are measured against.
+static struct header *find_linear_fit(struct heap *h, uint64_t size,
+                                      enum algs rule) {
+  struct header *fit = NULL;
+  for (struct header *chunk = h->list; chunk; chunk = chunk->next) {
+    uint64_t s = chunk_size(chunk);
+    if (s < size)
+      continue;
+    if (rule != BEST_FIT && rule != WORST_FIT)
+      return chunk;
+    if (!fit || (rule == BEST_FIT ? s < chunk_size(fit) : s > chunk_size(fit)))
+      fit = chunk;
+  }
+  return fit;
+}
+
+// -----------------------------
+// DENSE ARRAY
+// -----------------------------
+// ALLOC_DENSE keeps the sizes of the free chunks in one contiguous array,
+// beside an array of the chunks themselves, and scans DENSE_LANES sizes per
+// step instead of following a link per chunk. The back link of a chunk is
+// its slot in the chunk array, and a chunk taken out is replaced by the
+// last one. Slots past the count hold size 0, which never fits, so the
+// scans read whole steps. Sizes are 32-bit, which SSE2 compares in one
+// instruction; chunks of DENSE_SIZE_MAX bytes or more go to the list. The
+// arrays start with DENSE_MIN slots and double when they are full.
+#define DENSE_MIN 256
+#define DENSE_LANES 8
+#define DENSE_SIZE_MAX INT32_MAX
+
+// The scans are loops over the lanes of a step, which gcc -O2 turns into
+// vector compares. They are built for AVX2 and for the baseline, and the
+// loader picks the one the CPU runs. ThreadSanitizer builds get only the
+// baseline: the loader's pick runs before its runtime is set up
+#if defined(__x86_64__) && !defined(__clang__) && !defined(__SANITIZE_THREAD__)
+#define DENSE_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define DENSE_KERNEL
+#endif
+
+static size_t dense_bytes(size_t cap) {
+  return cap * (sizeof(int32_t) + sizeof(struct header *));
+}
 
-      heap_origin = mem;
-      heap_end = sbrk(0); // current program break (end of heap)
+static bool dense_slot(const struct heap *h, struct header **link) {
+  return h->dense_chunks && link >= h->dense_chunks &&
+         link < h->dense_chunks + h->dense_count;
+}
 
-      struct header *block = (struct header *)mem;
-      block->size = size + sizeof(struct header);
-      block->next = NULL;
+// Moves the arrays to ones twice as large, and the back links with them
+static bool dense_grow(struct heap *h) {
+  size_t cap = h->dense_cap ? h->dense_cap * 2 : DENSE_MIN;
+  void *mem = mmap(NULL, dense_bytes(cap), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return false;
+  int32_t *sizes = mem;
+  struct header **chunks = (struct header **)(sizes + cap);
+  for (size_t i = 0; i < h->dense_count; i++) {
+    sizes[i] = h->dense_sizes[i];
+    chunks[i] = h->dense_chunks[i];
+    set_back(h, chunks[i], &chunks[i]);
+  }
+  if (h->dense_sizes)
+    munmap(h->dense_sizes, dense_bytes(h->dense_cap));
+  h->dense_sizes = sizes;
+  h->dense_chunks = chunks;
+  h->dense_cap = cap;
+  return true;
+}
 
-      struct header *next_block = (struct header *)((char *)(block + 1) + size);
-      next_block->size = INCREMENT - sizeof(struct header) * 2 - size;
-      next_block->next = NULL;
+static bool dense_push(struct heap *h, struct header *chunk) {
+  if (chunk_size(chunk) >= DENSE_SIZE_MAX)
+    return false;
+  if (h->dense_count == h->dense_cap && !dense_grow(h))
+    return false;
+  size_t i = h->dense_count++;
+  h->dense_sizes[i] = chunk_size(chunk);
+  h->dense_chunks[i] = chunk;
+  chunk->next = NULL;
+  set_back(h, chunk, &h->dense_chunks[i]);
+  return true;
+}
 
-      head = next_block;
+static void dense_take(struct heap *h, struct header *chunk) {
+  size_t i = get_back(h, chunk) - h->dense_chunks;
+  size_t last = --h->dense_count;
+  h->dense_sizes[i] = h->dense_sizes[last];
+  h->dense_chunks[i] = h->dense_chunks[last];
+  h->dense_sizes[last] = 0;
+  if (i != last)
+    set_back(h, h->dense_chunks[i], &h->dense_chunks[i]);
+}
 
-      void *user_ptr = (void *)(block + 1);
-      printf("[alloc] allocated %d bytes at %p, next free at %p (free %lu "
-             "bytes)\n",
-             size, user_ptr, head, head->size);
-      return user_ptr;
+// Last slot whose size is between min and max. Chunks are pushed at the
+// end, so first fit takes the newest one, as a list would
+DENSE_KERNEL
+static size_t dense_last(const struct heap *h, int32_t min, int32_t max) {
+  const int32_t *sizes = h->dense_sizes;
+  size_t i = (h->dense_count + DENSE_LANES - 1) / DENSE_LANES * DENSE_LANES;
+  while (i > 0) {
+    i -= DENSE_LANES;
+    int32_t hit[DENSE_LANES], any = 0;
+    for (size_t l = 0; l < DENSE_LANES; l++) {
+      hit[l] = sizes[i + l] >= min && sizes[i + l] <= max;
+      any |= hit[l];
+    }
+    if (any == 0)
+      continue;
+    for (size_t l = DENSE_LANES - 1;; l--) {
+      if (hit[l])
+        return i + l;
     }
+  }
+  return SIZE_MAX;
+}
 
-    if (head->size < (uint64_t)size && heap_end - heap_origin == limit) {
-      printf("Out of memory! Requested %d, available %lu\n", size, head->size);
-      printf("Out of bound! Reached limit: %d\n", limit);
-      return NULL;
+// Smallest size of at least size, or DENSE_SIZE_MAX
+DENSE_KERNEL
+static int32_t dense_min(const struct heap *h, int32_t size) {
+  const int32_t *sizes = h->dense_sizes;
+  int32_t best[DENSE_LANES];
+  for (size_t l = 0; l < DENSE_LANES; l++)
+    best[l] = DENSE_SIZE_MAX;
+  for (size_t i = 0; i < h->dense_count; i += DENSE_LANES) {
+    for (size_t l = 0; l < DENSE_LANES; l++) {
+      int32_t s = sizes[i + l] >= size ? sizes[i + l] : DENSE_SIZE_MAX;
+      best[l] = s < best[l] ? s : best[l];
     }
+  }
+  int32_t min = best[0];
+  for (size_t l = 1; l < DENSE_LANES; l++)
+    min = best[l] < min ? best[l] : min;
+  return min;
+}
 
-    // logic for last space:
-    if (head->size > (uint64_t)size &&
-        head->size < (uint64_t)size + sizeof(struct header) * 2 &&
-        heap_end - heap_origin < limit) {
-      printf("Free %lu, requested %d, assigning last block!\n", head->size,
-             size);
-      struct header *block = head;
-      block->size += sizeof(struct header);
-      void *user_ptr = (void *)(block + 1);
-      head = NULL;
-      return user_ptr;
+DENSE_KERNEL
+static int32_t dense_max(const struct heap *h) {
+  const int32_t *sizes = h->dense_sizes;
+  int32_t best[DENSE_LANES] = {0};
+  for (size_t i = 0; i < h->dense_count; i += DENSE_LANES) {
+    for (size_t l = 0; l < DENSE_LANES; l++)
+      best[l] = sizes[i + l] > best[l] ? sizes[i + l] : best[l];
+  }
+  int32_t max = best[0];
+  for (size_t l = 1; l < DENSE_LANES; l++)
+    max = best[l] > max ? best[l] : max;
+  return max;
+}
+
+// Slot of the fit by the rule in the array, or SIZE_MAX
+static size_t dense_fit(const struct heap *h, uint64_t size, enum algs rule) {
+  if (size >= DENSE_SIZE_MAX)
+    return SIZE_MAX;
+  if (rule == BEST_FIT) {
+    int32_t min = dense_min(h, size);
+    return min == DENSE_SIZE_MAX ? SIZE_MAX : dense_last(h, min, min);
+  }
+  if (rule == WORST_FIT) {
+    int32_t max = dense_max(h);
+    return max < (int32_t)size ? SIZE_MAX : dense_last(h, max, max);
+  }
+  return dense_last(h, size, DENSE_SIZE_MAX);
+}
+
+// A fit by the rule of the given policy, from the array or the list
+static struct header *find_dense_fit(struct heap *h, uint64_t size,
+                                     enum algs rule) {
+  size_t i = dense_fit(h, size, rule);
+  struct header *fit = i == SIZE_MAX ? NULL : h->dense_chunks[i];
+  if (!h->list)
+    return fit;
+  struct header *spill = find_linear_fit(h, size, rule);
+  if (!fit || (spill && (rule == BEST_FIT
+                             ? chunk_size(spill) < chunk_size(fit)
+                             : rule == WORST_FIT &&
+                                   chunk_size(spill) > chunk_size(fit))))
+    fit = spill;
+  return fit;
+}
+
+// -----------------------------
+// FREE CHUNKS
+// -----------------------------
+// The index the chunks are kept in depends on the policy
+static void chunk_insert(struct heap *h, struct header *chunk) {
+  h->free_total += chunk->size;
+  h->free_count++;
+  h->stats.free_hist[hist_bucket(chunk->size - HEADER_SIZE)]++;
+  chunk->size |= FREE_BIT;
+  if (h->dense && dense_push(h, chunk))
+    return;
+  if (h->dense || h->linear)
+    list_push(h, &h->list, chunk);
+  else if (h->algs == FIRST_FIT)
+    bin_push(h, chunk);
+  else if (h->algs == TLSF)
+    tlsf_push(h, chunk);
+  else if (chunk_size(chunk) < TREE_MIN)
+    small_push(h, chunk);
+  else
+    tree_insert(h, chunk);
+}
+
+static void chunk_remove(struct heap *h, struct header *chunk) {
+  if (h->dense && dense_slot(h, get_back(h, chunk)))
+    dense_take(h, chunk);
+  else if (h->dense || h->linear)
+    list_take(h, chunk);
+  else if (h->algs == FIRST_FIT)
+    bin_take(h, chunk);
+  else if (h->algs == TLSF)
+    tlsf_take(h, chunk);
+  else if (chunk_size(chunk) < TREE_MIN)
+    small_take(h, chunk);
+  else
+    tree_remove(h, chunk);
+  set_back(h, chunk, NULL);
+  chunk->size &= ~FREE_BIT;
+  chunk->next = NULL;
+  h->free_total -= chunk->size;
+  h->free_count--;
+  h->stats.free_hist[hist_bucket(chunk->size - HEADER_SIZE)]--;
+}
+
+static struct header *find_fit(struct heap *h, uint64_t size) {
+  if (h->dense)
+    return find_dense_fit(h, size, h->algs);
+  if (h->linear)
+    return find_linear_fit(h, size, h->algs);
+  switch (h->algs) {
+  case FIRST_FIT:
+    return find_first_fit(h, size);
+  case BEST_FIT:
+    return find_best_fit(h, size);
+  case WORST_FIT:
+    return find_worst_fit(h, size);
+  case TLSF:
+    return find_tlsf_fit(h, size);
+  }
+  return NULL;
+}
+
+// Calls f on every free chunk
+static void chunk_walk(struct heap *h, void (*f)(const struct header *)) {
+  for (size_t i = 0; i < h->dense_count; i++)
+    f(h->dense_chunks[i]);
+  for (struct header *chunk = h->list; chunk != NULL; chunk = chunk->next)
+    f(chunk);
+  for (size_t c = 0; c < CLASS_COUNT; c++) {
+    for (struct header *chunk = h->bins[c]; chunk != NULL;
+         chunk = chunk->next)
+      f(chunk);
+  }
+  for (size_t i = 0; i < SMALL_COUNT; i++) {
+    for (struct header *chunk = h->small[i]; chunk != NULL;
+         chunk = chunk->next)
+      f(chunk);
+  }
+  for (size_t i = 0; i < TLSF_FL * TLSF_SL; i++) {
+    for (struct header *chunk = h->tlsf[i / TLSF_SL][i % TLSF_SL];
+         chunk != NULL; chunk = chunk->next)
+      f(chunk);
+  }
+  // In order, climbing back up through the parent links
+  struct header *chunk = tree_min(h);
+  while (chunk) {
+    f(chunk);
+    if (NODE(chunk)->right) {
+      chunk = NODE(chunk)->right;
+      while (NODE(chunk)->left)
+        chunk = NODE(chunk)->left;
+    } else {
+      struct header *parent = NODE(chunk)->parent;
+      while (parent && NODE(parent)->right == chunk) {
+        chunk = parent;
+        parent = NODE(chunk)->parent;
+      }
+      chunk = parent;
     }
+  }
+}
 
-    if (head->size > (uint64_t)size &&
-        head->size < (uint64_t)size + sizeof(struct header) &&
-        heap_end - heap_origin == limit) {
-      printf("Free %lu, requested %d, assigning last block! second one\n",
-             head->size, size);
-      struct header *block = head;
-      void *user_ptr = (void *)(block + 1);
-      head = NULL;
-      return user_ptr;
+static struct header *largest_chunk(struct heap *h) {
+  if (h->free_count == 0)
+    return NULL;
+  if (h->dense)
+    return find_dense_fit(h, 1, WORST_FIT);
+  if (!h->linear && (h->algs == BEST_FIT || h->algs == WORST_FIT))
+    return h->root ? tree_max(h) : h->small[31 - __builtin_clz(h->small_map)];
+  // The biggest chunk is in the highest non-empty list
+  struct header *list;
+  if (h->linear) {
+    list = h->list;
+  } else if (h->algs == TLSF) {
+    size_t f = 63 - __builtin_clzll(h->tlsf_fl_map);
+    list = h->tlsf[f][31 - __builtin_clz(h->tlsf_sl_map[f])];
+  } else {
+    list = h->bins[31 - __builtin_clz(h->bin_map)];
+  }
+  struct header *largest = NULL;
+  for (struct header *chunk = list; chunk; chunk = chunk->next) {
+    if (!largest || chunk_size(chunk) > chunk_size(largest))
+      largest = chunk;
+  }
+  return largest;
+}
+
+static struct header *smallest_chunk(struct heap *h) {
+  if (h->free_count == 0)
+    return NULL;
+  if (h->dense)
+    return find_dense_fit(h, 1, BEST_FIT);
+  if (!h->linear && (h->algs == BEST_FIT || h->algs == WORST_FIT))
+    return h->small_map ? h->small[__builtin_ctz(h->small_map)] : tree_min(h);
+  struct header *list;
+  if (h->linear) {
+    list = h->list;
+  } else if (h->algs == TLSF) {
+    size_t f = __builtin_ctzll(h->tlsf_fl_map);
+    list = h->tlsf[f][__builtin_ctz(h->tlsf_sl_map[f])];
+  } else {
+    list = h->bins[__builtin_ctz(h->bin_map)];
+  }
+  struct header *smallest = NULL;
+  for (struct header *chunk = list; chunk; chunk = chunk->next) {
+    if (!smallest || chunk_size(chunk) < chunk_size(smallest))
+      smallest = chunk;
+  }
+  return smallest;
+}
+
+// -----------------------------
+// SEGMENTS
+// -----------------------------
+// A heap that does not use the break grows by mmap'd segments, each one
+// twice the size of the one before, up to SEGMENT_MAX: the main heap with
+// ALLOC_ARENAS, and every arena handle. A segment ends with a fence, an
+// allocated header with no payload whose next field holds the back link of
+// the segment's last chunk, so its chunks never reach the heap's end.
+static uint64_t mmap_threshold = 0; // payloads mapped on their own, 0 = off
+static uint64_t alloc_align = 1;    // alignment of alloc() payloads
+static bool checked = false;        // main heap blocks have guards
+static bool linear = false;         // ALLOC_LINEAR for the next heap
+static bool dense = false;          // ALLOC_DENSE for the next heap
+
+static uint64_t page_round(uint64_t size) {
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+// Bytes taken from the system for the heap, counted against the limit
+static uint64_t heap_bytes(struct heap *h) {
+  return (char *)h->end - (char *)h->origin + h->segment_total;
+}
+
+// Counts one more growth of the heap
+static void note_grow(struct heap *h) {
+  h->stats.grows++;
+  if (heap_bytes(h) > h->stats.peak_heap_size)
+    h->stats.peak_heap_size = heap_bytes(h);
+}
+
+// Maps a segment whose chunk holds size bytes and returns that chunk
+static struct header *segment_grow(struct heap *h, uint64_t size) {
+  uint64_t need = page_round(size + sizeof(struct segment) + HEADER_SIZE);
+  uint64_t len = need > h->segment_next ? need : h->segment_next;
+  uint64_t heap_size = heap_bytes(h);
+  if (h->limit > 0 && heap_size + len > (uint64_t)h->limit) {
+    // Take what is left under the limit if that is enough
+    uint64_t left =
+        heap_size < (uint64_t)h->limit ? h->limit - heap_size : 0;
+    len = left - left % sysconf(_SC_PAGESIZE);
+    if (len < need) {
+      printf("Out of memory! Requested %lu, reached limit: %d\n",
+             size - HEADER_SIZE, h->limit);
+      return NULL;
     }
+  }
 
-    if ((heap_end - heap_origin < limit && head->size < size) ||
-        (heap_end - heap_origin < limit && head->size >= size &&
-         head->size < size + sizeof(struct header))) {
-      printf("Free %lu, requested %d, under limit, increasing size!\n",
-             head->size, size);
-      void *res = sbrk(INCREMENT);
-      if (res == (void *)-1) {
-        perror("sbrk failed");
-        return NULL;
+  struct segment *segment = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (segment == MAP_FAILED) {
+    perror("mmap failed");
+    return NULL;
+  }
+  segment->next = h->segments;
+  segment->size = len;
+  h->segments = segment;
+  h->segment_total += len;
+  if (h->segment_next < SEGMENT_MAX)
+    h->segment_next *= 2;
+  note_grow(h);
+
+  struct header *chunk = (struct header *)(segment + 1);
+  chunk->size = len - sizeof(struct segment) - HEADER_SIZE;
+  chunk->next = NULL;
+  struct header *fence = (struct header *)((char *)chunk + chunk->size);
+  fence->size = HEADER_SIZE;
+  fence->next = NULL;
+  return chunk;
+}
+
+static void segment_release(struct heap *h) {
+  while (h->segments) {
+    struct segment *next = h->segments->next;
+    munmap(h->segments, h->segments->size);
+    h->segments = next;
+  }
+  h->segment_total = 0;
+  h->segment_next = SEGMENT_MIN;
+}
+
+// Forgets every block of the heap, keeping its policy, limit and backing.
+// Dense arrays of the first size are kept for the next blocks, emptied
+static void heap_drop(struct heap *h) {
+  segment_release(h);
+  if (h->dense_cap > DENSE_MIN) {
+    munmap(h->dense_sizes, dense_bytes(h->dense_cap));
+    h->dense_sizes = NULL;
+    h->dense_chunks = NULL;
+    h->dense_cap = 0;
+  } else if (h->dense_sizes) {
+    memset(h->dense_sizes, 0, h->dense_count * sizeof(int32_t));
+  }
+  struct heap empty = {.limit = h->limit,
+                       .algs = h->algs,
+                       .linear = h->linear,
+                       .dense = h->dense,
+                       .dense_sizes = h->dense_sizes,
+                       .dense_chunks = h->dense_chunks,
+                       .dense_cap = h->dense_cap,
+                       .defer_limit = h->defer_limit,
+                       .trim_threshold = h->trim_threshold,
+                       .checked = h->checked,
+                       .use_segments = h->use_segments,
+                       .segment_next = SEGMENT_MIN};
+  *h = empty;
+}
+
+// Big blocks skip the heap: they get a mapping of their own, given back to
+// the system on dealloc()
+static void *large_alloc(uint64_t size) {
+  uint64_t len = page_round(size + HEADER_SIZE);
+  struct header *block = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == MAP_FAILED) {
+    perror("mmap failed");
+    return NULL;
+  }
+  block->size = len | MMAP_BIT;
+  block->next = NULL;
+  return block + 1;
+}
+
+static void large_free(struct header *block) {
+  munmap(block, block->size & ~MMAP_BIT);
+}
+
+// -----------------------------
+// HEAP
+// -----------------------------
+// Unlinks the free chunk that ends at the top of the heap, if any
+static struct header *take_top(struct heap *h) {
+  struct header *top = h->top_back ? *h->top_back : NULL;
+  if (top)
+    chunk_remove(h, top);
+  return top;
+}
+
+// Grows the heap by whole INCREMENTs until its top chunk holds size bytes
+// Returns that chunk, unlinked, or NULL past the limit
+static struct header *grow(struct heap *h, uint64_t size) {
+  if (h->use_segments)
+    return segment_grow(h, size);
+  struct header *top = take_top(h);
+  uint64_t have = top ? top->size : 0;
+  uint64_t inc = (size - have + INCREMENT - 1) / INCREMENT * INCREMENT;
+
+  if (h->limit > 0 && heap_bytes(h) + inc > (uint64_t)h->limit) {
+    printf("Out of memory! Requested %lu, reached limit: %d\n",
+           size - HEADER_SIZE, h->limit);
+    if (top)
+      chunk_insert(h, top);
+    return NULL;
+  }
+
+  void *mem = sbrk(inc);
+  if (mem == (void *)-1) {
+    perror("sbrk failed");
+    if (top)
+      chunk_insert(h, top);
+    return NULL;
+  }
+  if (h->end == h->origin) {
+    // Empty heap: it starts wherever the break is now
+    h->origin = h->end = mem;
+  } else if (mem != h->end) {
+    // Something else moved the break, so the heap cannot stay contiguous
+    sbrk(-inc);
+    if (top)
+      chunk_insert(h, top);
+    return NULL;
+  }
+  h->end = (char *)mem + inc;
+  note_grow(h);
+
+  struct header *chunk = top ? top : mem;
+  chunk->size = have + inc;
+  chunk->next = NULL;
+  return chunk;
+}
+
+// Gives the end of block past size back to the free chunks
+static void split(struct heap *h, struct header *block, uint64_t size) {
+  if (block->size - size < MIN_SPLIT)
+    return;
+  struct header *rest = (struct header *)((char *)block + size);
+  rest->size = block->size - size;
+  block->size = size;
+  chunk_insert(h, rest);
+  h->stats.splits++;
+}
+
+// Bytes to skip at the start of chunk so that the payload after them is
+// aligned; a gap is only left if it can be a free chunk of its own
+static uint64_t align_pad(const struct header *chunk, uint64_t align) {
+  uint64_t pad = -(uintptr_t)(chunk + 1) & (align - 1);
+  while (pad > 0 && pad < MIN_SPLIT)
+    pad += align;
+  return pad;
+}
+
+// Gives a block back to the free chunks, merged with its free neighbours,
+// and returns the chunk it ended up in
+static struct header *merge(struct heap *h, struct header *block) {
+  // Merge with the free chunk right after, then the one right before
+  struct header *after = (struct header *)((char *)block + block->size);
+  if ((void *)after != h->end && (after->size & FREE_BIT)) {
+    chunk_remove(h, after);
+    block->size += after->size;
+    h->stats.merges++;
+  }
+  // Taking after may have moved the back link of the chunk before
+  struct header **before = (struct header **)block->next;
+  if (before) {
+    struct header *chunk = *before;
+    chunk_remove(h, chunk);
+    chunk->size += block->size;
+    block = chunk;
+    h->stats.merges++;
+  }
+  chunk_insert(h, block);
+  return block;
+}
+
+// Gives the pages of a free chunk of at least the trim threshold back to
+// the system. At the top of the break they are cut off the heap; in a
+// segment they stay mapped but are dropped until touched again. The first
+// page keeps the chunk's links and the last one may be shared.
+static void heap_trim(struct heap *h, struct header *chunk) {
+  if (h->trim_threshold == 0 || chunk_size(chunk) < h->trim_threshold)
+    return;
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  char *end = (char *)chunk + chunk_size(chunk);
+  if (h->use_segments) {
+    char *from = (char *)page_round((uintptr_t)chunk + TREE_MIN);
+    char *to = end - (uintptr_t)end % page;
+    if (from < to && madvise(from, to - from, MADV_DONTNEED) == 0)
+      h->stats.trims++;
+    return;
+  }
+  // Only if nothing was put on top of our heap
+  if ((void *)end != h->end || sbrk(0) != h->end)
+    return;
+  uint64_t cut = (chunk_size(chunk) - MIN_SPLIT) / page * page;
+  if (cut == 0)
+    return;
+  chunk_remove(h, chunk);
+  chunk->size -= cut;
+  sbrk(-cut);
+  h->end = end - cut;
+  chunk_insert(h, chunk);
+  h->stats.trims++;
+}
+
+// Merges every block of the quick lists
+static void quick_flush(struct heap *h) {
+  for (size_t w = 0; w < QUICK_COUNT / 64; w++) {
+    for (uint64_t map = h->quick_map[w]; map; map &= map - 1) {
+      size_t i = w * 64 + __builtin_ctzll(map);
+      struct header *block = h->quick[i];
+      while (block) {
+        struct header *next = *(struct header **)(block + 1);
+        merge(h, block);
+        block = next;
       }
-      heap_end = sbrk(0);
-      head->size += INCREMENT;
+      h->quick[i] = NULL;
     }
-    struct header *block = head;
-    struct header *next_block = (struct header *)((char *)(block + 1) + size);
-    next_block->size = block->size - size - sizeof(struct header);
-    next_block->next = NULL;
-    block->size = size + sizeof(struct header);
-    void *user_ptr = (void *)(block + 1);
-    head = next_block;
-    if (head->size == 0) {
-      printf(
-          "head size is 0, no free space ahead. letting last block get 16.\n");
-      block->size += sizeof(struct header);
-      head = (void *)(next_block + 1);
+    h->quick_map[w] = 0;
+  }
+  h->quick_count = 0;
+}
+
+// Takes a block of exactly size bytes from the quick lists, if one is there
+static struct header *quick_take(struct heap *h, uint64_t size,
+                                 uint64_t align) {
+  if (size >= QUICK_COUNT || h->quick[size] == NULL ||
+      (uintptr_t)(h->quick[size] + 1) % align != 0)
+    return NULL;
+  struct header *block = h->quick[size];
+  h->quick[size] = *(struct header **)(block + 1);
+  if (h->quick[size] == NULL)
+    h->quick_map[size / 64] &= ~(1ULL << (size % 64));
+  h->quick_count--;
+  return block;
+}
+
+static void *heap_alloc(struct heap *h, uint64_t size, uint64_t align) {
+  uint64_t need = size + HEADER_SIZE;
+  // Enough for the block wherever the payload has to start
+  uint64_t slack = align > 1 ? align + MIN_SPLIT : 0;
+  struct header *block = h->quick_count ? quick_take(h, size, align) : NULL;
+  if (block) {
+    h->stats.in_use += block->size - HEADER_SIZE;
+    if (h->stats.in_use > h->stats.peak_in_use)
+      h->stats.peak_in_use = h->stats.in_use;
+    return block + 1;
+  }
+
+  block = find_fit(h, need);
+  if (block == NULL && h->quick_count > 0) {
+    // Merging the waiting blocks may make room
+    quick_flush(h);
+    block = find_fit(h, need);
+  }
+  if (block && align_pad(block, align) + need > chunk_size(block))
+    block = find_fit(h, need + slack);
+  if (block)
+    chunk_remove(h, block);
+  else if ((block = grow(h, need + slack)) == NULL)
+    return NULL;
+
+  // The gap in front goes back to the free chunks
+  uint64_t pad = align_pad(block, align);
+  if (pad > 0) {
+    struct header *gap = block;
+    block = (struct header *)((char *)gap + pad);
+    block->size = gap->size - pad;
+    gap->size = pad;
+    chunk_insert(h, gap);
+  }
+  split(h, block, need);
+  h->stats.in_use += block->size - HEADER_SIZE;
+  if (h->stats.in_use > h->stats.peak_in_use)
+    h->stats.peak_in_use = h->stats.in_use;
+
+  void *user_ptr = (void *)(block + 1);
+  TRACE_PRINT("[alloc] allocated %lu bytes at %p (block size %lu)\n", size,
+              user_ptr, block->size);
+  return user_ptr;
+}
+
+static void heap_free(struct heap *h, struct header *block) {
+  TRACE_PRINT("[dealloc] freed block %p, size=%lu\n", block,
+              block->size - HEADER_SIZE);
+  h->stats.in_use -= block->size - HEADER_SIZE;
+  uint64_t i = block->size - HEADER_SIZE;
+  // The link must not cover the guard word at the end of the payload
+  uint64_t min = sizeof(struct header *) * (h->checked ? 2 : 1);
+  if (h->defer_limit == 0 || i < min || i >= QUICK_COUNT) {
+    heap_trim(h, merge(h, block));
+    return;
+  }
+  // The block stays allocated as far as its neighbours can tell, so its
+  // header is left alone and the link goes in the payload
+  *(struct header **)(block + 1) = h->quick[i];
+  h->quick[i] = block;
+  h->quick_map[i / 64] |= 1ULL << (i % 64);
+  if (++h->quick_count >= h->defer_limit) {
+    quick_flush(h);
+    if (h->top_back)
+      heap_trim(h, *h->top_back);
+  }
+}
+
+// Resizes an allocated block in place, taking from or giving back to the
+// free chunk right after it, or growing the heap under a block at its top
+// Returns false if the block cannot grow where it is
+static bool heap_resize(struct heap *h, struct header *block,
+                        uint64_t size) {
+  uint64_t need = size + HEADER_SIZE;
+  struct header *after = (struct header *)((char *)block + block->size);
+  bool after_free = (void *)after != h->end && (after->size & FREE_BIT);
+  uint64_t have = block->size + (after_free ? chunk_size(after) : 0);
+
+  struct header *more = NULL;
+  if (have >= need) {
+    if (after_free)
+      chunk_remove(h, after);
+    more = after_free ? after : NULL;
+  } else if (h->use_segments || (char *)block + have != h->end ||
+             (more = grow(h, need - block->size)) == NULL) {
+    return false;
+  }
+
+  uint64_t old = block->size;
+  if (more) {
+    block->size += more->size;
+    h->stats.merges++;
+  }
+  split(h, block, need);
+  h->stats.in_use += block->size - old;
+  if (h->stats.in_use > h->stats.peak_in_use)
+    h->stats.peak_in_use = h->stats.in_use;
+  return true;
+}
+
+// -----------------------------
+// THREAD CACHES
+// -----------------------------
+// With allocmt() on, the heap is shared behind heap_mutex and each thread
+// keeps its own lists of small blocks. Small allocations and frees only
+// touch the caller's lists; the lock is taken to move TCACHE_BATCH blocks
+// between a list and the heap at once, and for bigger blocks.
+// Cached blocks stay allocated as far as the heap is concerned.
+#define TCACHE_STEP 16    // payload sizes are rounded up to this
+#define TCACHE_CLASSES 16 // payloads of 16, 32, ..., 256 bytes are cached
+#define TCACHE_BATCH 16   // blocks moved between a list and the heap at once
+
+struct tcache {
+  void *bins[TCACHE_CLASSES]; // payloads, linked through their first word
+  size_t count[TCACHE_CLASSES];
+  uint64_t gen; // heap the cached blocks belong to
+  bool registered;
+  // Calls served by the cache, added to stats when the lock is next taken
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t failed;
+  uint64_t requests[ALLOC_HIST_BUCKETS];
+};
+
+static bool threaded = false;
+static uint64_t heap_gen = 0; // bumped by resetalloc(), which drops the heap
+static pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static __thread struct tcache tcache;
+
+static void heap_lock(void) {
+  if (threaded)
+    pthread_mutex_lock(&heap_mutex);
+}
+
+static void heap_unlock(void) {
+  if (threaded)
+    pthread_mutex_unlock(&heap_mutex);
+}
+
+static void *cache_pop(size_t c) {
+  void *p = tcache.bins[c];
+  tcache.bins[c] = *(void **)p;
+  tcache.count[c]--;
+  return p;
+}
+
+static void cache_push(size_t c, void *p) {
+  *(void **)p = tcache.bins[c];
+  tcache.bins[c] = p;
+  tcache.count[c]++;
+}
+
+// Adds the calls this thread's cache served to stats, with the lock held
+static void cache_count(void) {
+  struct allocstats *stats = &main_heap.stats;
+  stats->allocs += tcache.allocs;
+  stats->frees += tcache.frees;
+  stats->failed += tcache.failed;
+  for (size_t b = 0; b < ALLOC_HIST_BUCKETS; b++)
+    stats->request_hist[b] += tcache.requests[b];
+  tcache.allocs = tcache.frees = tcache.failed = 0;
+  memset(tcache.requests, 0, sizeof(tcache.requests));
+}
+
+// Gives n blocks of class c back to the heap, with the lock held
+static void cache_flush(size_t c, size_t n) {
+  while (n-- > 0 && tcache.count[c] > 0)
+    heap_free(&main_heap, (struct header *)cache_pop(c) - 1);
+}
+
+// Thread exit: the cached blocks go back to the heap
+static void cache_exit(void *arg) {
+  (void)arg;
+  heap_lock();
+  cache_count();
+  if (tcache.gen == heap_gen) {
+    for (size_t c = 0; c < TCACHE_CLASSES; c++)
+      cache_flush(c, tcache.count[c]);
+  }
+  heap_unlock();
+}
+
+static void make_key(void) { pthread_key_create(&tcache_key, cache_exit); }
+
+// The child of a fork() only has the thread that forked, so a heap lock
+// held by another thread would never be released there
+static void fork_child(void) { pthread_mutex_init(&heap_mutex, NULL); }
+
+static void fork_handlers(void) {
+  pthread_atfork(heap_lock, heap_unlock, fork_child);
+}
+
+static void cache_check(void) {
+  if (!tcache.registered) {
+    pthread_once(&tcache_once, make_key);
+    pthread_setspecific(tcache_key, &tcache);
+    tcache.registered = true;
+  }
+  // Blocks cached before a reset point into the old heap
+  if (tcache.gen != heap_gen) {
+    memset(tcache.bins, 0, sizeof(tcache.bins));
+    memset(tcache.count, 0, sizeof(tcache.count));
+    tcache.gen = heap_gen;
+  }
+}
+
+static void *cache_alloc(size_t size) {
+  size_t c = size ? (size + TCACHE_STEP - 1) / TCACHE_STEP - 1 : 0;
+  cache_check();
+  tcache.allocs++;
+  tcache.requests[hist_bucket(size)]++;
+  if (tcache.count[c] == 0) {
+    heap_lock();
+    cache_count();
+    for (size_t i = 0; i < TCACHE_BATCH; i++) {
+      void *p = heap_alloc(&main_heap, (c + 1) * TCACHE_STEP, alloc_align);
+      if (!p)
+        break;
+      cache_push(c, p);
+    }
+    // In a heap with a limit the other classes may hold what this one needs
+    if (tcache.count[c] == 0) {
+      for (size_t k = 0; k < TCACHE_CLASSES; k++)
+        cache_flush(k, tcache.count[k]);
+      void *p = heap_alloc(&main_heap, (c + 1) * TCACHE_STEP, alloc_align);
+      if (p)
+        cache_push(c, p);
+    }
+    heap_unlock();
+    if (tcache.count[c] == 0) {
+      tcache.failed++;
+      return NULL;
     }
-    printf("[alloc] allocated %d bytes at %p, next free at %p (free %lu "
-           "bytes)\n",
-           size, user_ptr, head, head->size);
+  }
+  return cache_pop(c);
+}
 
-    return user_ptr;
-  } else {
-    struct header *block = head;
-    struct header *temp = NULL;
-    switch (algs) {
-    case FIRST_FIT:
-      temp = find_first_fit(block, size + sizeof(struct header));
-      break;
-    case BEST_FIT:
-      temp = find_best_fit(block, size + sizeof(struct header));
-      break;
-    case WORST_FIT:
-      temp = find_worst_fit(block, size + sizeof(struct header));
+// Returns false if the block is not a size the caches hold
+static bool cache_free(struct header *block) {
+  // A block absorbs small remainders, so it serves the class below its size
+  uint64_t size = block->size - HEADER_SIZE;
+  if (size < TCACHE_STEP || size / TCACHE_STEP > TCACHE_CLASSES)
+    return false;
+  size_t c = size / TCACHE_STEP - 1;
+  cache_check();
+  tcache.frees++;
+  cache_push(c, block + 1);
+  if (tcache.count[c] > TCACHE_BATCH * 2) {
+    heap_lock();
+    cache_count();
+    cache_flush(c, TCACHE_BATCH);
+    heap_unlock();
+  }
+  return true;
+}
+
+// -----------------------------
+// TRACE
+// -----------------------------
+// alloctrace() records every alloc() and dealloc() for offline replay. The
+// lines are formatted into a static buffer and written out with write(),
+// so tracing never calls malloc() behind the heap's back.
+#define TRACE_LINE 64 // longest formatted event
+
+// size < 0 is a dealloc()
+static size_t trace_format(char *buf, uintptr_t p, int64_t size) {
+  if (size < 0)
+    return snprintf(buf, TRACE_LINE, "f %lx\n", (unsigned long)p);
+  return snprintf(buf, TRACE_LINE, "a %lx %ld\n", (unsigned long)p,
+                  (long)size);
+}
+
+static int trace_fd = -1;
+static char trace_buf[4096];
+static size_t trace_len = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void trace_flush(void) {
+  size_t done = 0;
+  while (done < trace_len) {
+    ssize_t n = write(trace_fd, trace_buf + done, trace_len - done);
+    if (n <= 0)
       break;
+    done += n;
+  }
+  trace_len = 0;
+}
+
+static void trace_event(void *p, int size) {
+  pthread_mutex_lock(&trace_mutex);
+  if (trace_fd >= 0) {
+    if (trace_len + TRACE_LINE > sizeof(trace_buf))
+      trace_flush();
+    trace_len += trace_format(trace_buf + trace_len, (uintptr_t)p, size);
+  }
+  pthread_mutex_unlock(&trace_mutex);
+}
+
+int alloctrace(const char *path) {
+  int res = 0;
+  pthread_mutex_lock(&trace_mutex);
+  if (trace_fd >= 0) {
+    trace_flush();
+    close(trace_fd);
+    trace_fd = -1;
+  }
+  if (path) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    res = trace_fd >= 0 ? 0 : -1;
+  }
+  pthread_mutex_unlock(&trace_mutex);
+  return res;
+}
+
+// With ALLOC_TRACE_LEVEL >= 1 the last RING_SIZE events are also kept in
+// memory. Threads claim slots with one atomic add and never wait; each slot
+// carries the number of the event in it, cleared while it is written, so
+// alloctrace_dump() skips slots that are being rewritten.
+#define RING_SIZE 4096 // a power of two
+
+struct ring_event {
+  _Atomic uint64_t seq; // event number + 1, 0 while the slot is written
+  _Atomic uintptr_t ptr;
+  _Atomic int64_t size;
+};
+
+static struct ring_event ring[RING_SIZE];
+static _Atomic uint64_t ring_head = 0; // number of events recorded
+
+#if ALLOC_TRACE_LEVEL >= 1
+static void ring_record(void *p, int64_t size) {
+  uint64_t n = atomic_fetch_add_explicit(&ring_head, 1, memory_order_relaxed);
+  struct ring_event *e = &ring[n & (RING_SIZE - 1)];
+  atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&e->ptr, (uintptr_t)p, memory_order_relaxed);
+  atomic_store_explicit(&e->size, size, memory_order_relaxed);
+  atomic_store_explicit(&e->seq, n + 1, memory_order_release);
+}
+#endif
+
+// Every alloc() and dealloc() goes through here
+static void note_event(void *p, int size) {
+#if ALLOC_TRACE_LEVEL >= 1
+  ring_record(p, size);
+#endif
+  if (trace_fd >= 0)
+    trace_event(p, size);
+}
+
+int alloctrace_dump(int fd) {
+  char buf[4096];
+  size_t len = 0;
+  int count = 0;
+  uint64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+  for (uint64_t n = head > RING_SIZE ? head - RING_SIZE : 0; n < head; n++) {
+    struct ring_event *e = &ring[n & (RING_SIZE - 1)];
+    if (atomic_load_explicit(&e->seq, memory_order_acquire) != n + 1)
+      continue;
+    uintptr_t p = atomic_load_explicit(&e->ptr, memory_order_relaxed);
+    int64_t size = atomic_load_explicit(&e->size, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&e->seq, memory_order_relaxed) != n + 1)
+      continue;
+    if (len + TRACE_LINE > sizeof(buf)) {
+      if (write(fd, buf, len) != (ssize_t)len)
+        return -1;
+      len = 0;
+    }
+    len += trace_format(buf + len, p, size);
+    count++;
+  }
+  if (len > 0 && write(fd, buf, len) != (ssize_t)len)
+    return -1;
+  return count;
+}
+
+// -----------------------------
+// HANDLES
+// -----------------------------
+// A handle is a slot of one table that holds the address of its block, so
+// compaction can move the block and fix the slot. The table is reserved up
+// front and its pages only touched when used. A handle block ends with a
+// hidden word that points back to its slot: a block is a handle block if
+// that word is in the table and the slot points to the block.
+#define HANDLE_MAX (1 << 20)
+
+static void **handles = NULL;     // the table
+static size_t handle_next = 0;    // slots below have been used
+static void **handle_free = NULL; // free slots, linked through themselves
+
+static void **handle_take(void) {
+  if (handles == NULL) {
+    handles = mmap(NULL, HANDLE_MAX * sizeof(void *), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (handles == MAP_FAILED) {
+      perror("mmap failed");
+      handles = NULL;
+      return NULL;
     }
+  }
+  void **slot = handle_free;
+  if (slot)
+    handle_free = *slot;
+  else if (handle_next < HANDLE_MAX)
+    slot = &handles[handle_next++];
+  return slot;
+}
 
-    struct header *next_block = get_next(block, temp);
-    struct header *new_block = (struct header *)((char *)(temp + 1) + size);
-    if (temp->size < size + sizeof(struct header)) {
-      void *user_ptr = (void *)(temp + 1);
-      head = next_block;
-      // printf("[alloc] same block: allocated %d bytes at %p\n", size,
-      // user_ptr);
-      return user_ptr;
-    } else {
-      new_block->size = temp->size - size - sizeof(struct header);
-      new_block->next = next_block;
-      temp->size = size + sizeof(struct header);
-      void *user_ptr = (void *)(temp + 1);
-      if (temp == head) {
-        head = new_block;
-      } else {
-        struct header *last = get_last(temp);
-        last->next = new_block;
+static void handle_put(void **slot) {
+  *slot = handle_free;
+  handle_free = slot;
+}
+
+// Forgets every handle, along with the blocks they point to
+static void handle_drop(void) {
+  if (handles)
+    munmap(handles, HANDLE_MAX * sizeof(void *));
+  handles = NULL;
+  handle_next = 0;
+  handle_free = NULL;
+}
+
+static void **handle_of(struct header *block) {
+  if (handles == NULL || block->size < HEADER_SIZE + sizeof(void *))
+    return NULL;
+  void **slot = *(void ***)((char *)block + block->size - sizeof(void *));
+  if (slot < handles || slot >= handles + handle_next ||
+      *slot != (void *)(block + 1))
+    return NULL;
+  return slot;
+}
+
+// Slides the handle blocks of [start, end) down over the free chunks in
+// front of them, so the free space gathers behind them. Blocks without a
+// handle stay where they are. Returns the number of blocks moved.
+static uint64_t compact_range(struct heap *h, char *start, char *end) {
+  uint64_t moved = 0;
+  for (char *p = start; p < end;) {
+    struct header *chunk = (struct header *)p;
+    struct header *block = (struct header *)(p + chunk_size(chunk));
+    void **slot;
+    if (!(chunk->size & FREE_BIT) || (char *)block == end ||
+        chunk_size(chunk) % alloc_align != 0 ||
+        (slot = handle_of(block)) == NULL) {
+      p += chunk_size(chunk);
+      continue;
+    }
+    // The block before the free chunk is allocated, so the moved block
+    // has no back link, and the space it leaves goes back to the free
+    // chunks merged with whatever follows
+    uint64_t gap = chunk_size(chunk);
+    chunk_remove(h, chunk);
+    uint64_t size = block->size;
+    memmove(chunk, block, size);
+    chunk->next = NULL;
+    *slot = chunk + 1;
+    struct header *rest = (struct header *)(p + size);
+    rest->size = gap;
+    rest->next = NULL;
+    merge(h, rest);
+    moved++;
+    p += size;
+  }
+  return moved;
+}
+
+static uint64_t heap_compact(struct heap *h) {
+  if (h->quick_count)
+    quick_flush(h);
+  uint64_t moved = 0;
+  for (struct segment *s = h->segments; s; s = s->next)
+    moved += compact_range(h, (char *)(s + 1),
+                           (char *)s + s->size - HEADER_SIZE);
+  if (h->origin)
+    moved += compact_range(h, h->origin, h->end);
+  if (h->top_back)
+    heap_trim(h, *h->top_back);
+  return moved;
+}
+
+// -----------------------------
+// CHECKS
+// -----------------------------
+// With ALLOC_CHECKED, every block gets GUARD_SIZE bytes more than asked for
+// and ends with a guard: a red zone of GUARD_BYTE from the end of the
+// payload, then a word that holds the payload size mixed with GUARD_KEY.
+// dealloc() checks the red zone, then sets the word to GUARD_FREED, so a
+// second dealloc() of the block is caught as well.
+#define GUARD_SIZE 16
+#define GUARD_BYTE 0xAB
+#define GUARD_KEY 0x5EC7E4A1C0DEDULL
+#define GUARD_FREED 0xF4EEDF4EEDF4EEDULL
+
+// Payload bytes of a heap or mapped block
+static uint64_t block_room(const struct header *block) {
+  return (block->size & ~(FREE_BIT | MMAP_BIT)) - HEADER_SIZE;
+}
+
+static uint64_t *guard_word(struct header *block, uint64_t *word) {
+  memcpy(word, (char *)(block + 1) + block_room(block) - sizeof(*word),
+         sizeof(*word));
+  return word;
+}
+
+static void guard_set(struct header *block, uint64_t word) {
+  memcpy((char *)(block + 1) + block_room(block) - sizeof(word), &word,
+         sizeof(word));
+}
+
+static void guard_arm(void *ptr, uint64_t size) {
+  struct header *block = (struct header *)ptr - 1;
+  uint64_t end = block_room(block) - sizeof(uint64_t);
+  memset((char *)ptr + size, GUARD_BYTE, end - size);
+  guard_set(block, size ^ GUARD_KEY);
+}
+
+// Returns what is wrong with an allocated block's guard, or NULL
+static const char *guard_fault(struct header *block) {
+  uint64_t word;
+  uint64_t size = *guard_word(block, &word) ^ GUARD_KEY;
+  uint64_t end = block_room(block) - sizeof(uint64_t);
+  if (word == GUARD_FREED || (block->size & FREE_BIT))
+    return "double free";
+  if (block_room(block) < GUARD_SIZE || size + sizeof(uint64_t) > end)
+    return "guard overwritten";
+  for (const unsigned char *p = (unsigned char *)(block + 1) + size;
+       p < (unsigned char *)(block + 1) + end; p++) {
+    if (*p != GUARD_BYTE)
+      return "write past the end";
+  }
+  return NULL;
+}
+
+static void guard_abort(const char *what, void *ptr) {
+  char buf[96];
+  int len = snprintf(buf, sizeof(buf), "alloc: %s of block %p\n", what, ptr);
+  write(STDERR_FILENO, buf, len);
+  abort();
+}
+
+// Checks the block before it is freed and marks it freed
+static void guard_free(void *ptr) {
+  struct header *block = (struct header *)ptr - 1;
+  const char *fault = guard_fault(block);
+  if (fault)
+    guard_abort(fault, ptr);
+  guard_set(block, GUARD_FREED);
+}
+
+static const char *verify_fault;
+static const void *verify_where;
+
+static bool verify_fail(const char *what, const void *where) {
+  verify_fault = what;
+  verify_where = where;
+  return false;
+}
+
+static bool in_heap(struct heap *h, const void *p) {
+  if ((char *)p >= (char *)h->origin && (char *)p < (char *)h->end)
+    return true;
+  for (struct segment *s = h->segments; s; s = s->next) {
+    if ((char *)p > (char *)s && (char *)p < (char *)s + s->size)
+      return true;
+  }
+  return false;
+}
+
+// The links that point to chunk from its index lead back to it
+static bool verify_links(struct heap *h, struct header *chunk) {
+  struct header **back = get_back(h, chunk);
+  if (dense_slot(h, back)) {
+    uint64_t size = h->dense_sizes[back - h->dense_chunks];
+    if (size != chunk_size(chunk))
+      return verify_fail("bad dense size", chunk);
+    return true;
+  }
+  bool tree = h->algs == BEST_FIT || h->algs == WORST_FIT;
+  if (tree && !h->linear && !h->dense) {
+    if (chunk_size(chunk) >= TREE_MIN) {
+      struct header *kids[2] = {NODE(chunk)->left, NODE(chunk)->right};
+      for (int i = 0; i < 2; i++) {
+        if (kids[i] && (!in_heap(h, kids[i]) || !(kids[i]->size & FREE_BIT) ||
+                        NODE(kids[i])->parent != chunk))
+          return verify_fail("bad size tree link", chunk);
       }
-      // printf("[alloc] else, allocated %d bytes at %p\n", size, user_ptr);
-      return user_ptr;
+      return true;
+    }
+  }
+  struct header *next = chunk->next;
+  if (next && (!in_heap(h, next) || !(next->size & FREE_BIT) ||
+               get_back(h, next) != &chunk->next))
+    return verify_fail("bad free list link", chunk);
+  return true;
+}
+
+// Walks the blocks of [start, end) one after the other
+static bool verify_range(struct heap *h, char *start, char *end,
+                         uint64_t *count, uint64_t *total) {
+  struct header *prev = NULL;
+  char *p = start;
+  for (; p < end; p += chunk_size((struct header *)p)) {
+    struct header *block = (struct header *)p;
+    bool is_free = block->size & FREE_BIT;
+    if (chunk_size(block) < HEADER_SIZE ||
+        chunk_size(block) > (uint64_t)(end - p))
+      return verify_fail("bad block size", block);
+    if (is_free) {
+      struct header **back = get_back(h, block);
+      if (prev && (prev->size & FREE_BIT))
+        return verify_fail("free chunks not merged", block);
+      if (back == NULL || *back != block)
+        return verify_fail("free chunk not in its index", block);
+      if (!verify_links(h, block))
+        return false;
+      (*count)++;
+      *total += chunk_size(block);
+    } else {
+      struct header **back = (struct header **)block->next;
+      bool prev_free = prev && (prev->size & FREE_BIT);
+      if (prev_free ? back == NULL || *back != prev : back != NULL)
+        return verify_fail("bad boundary tag", block);
+      const char *fault;
+      if (checked && handle_of(block) == NULL &&
+          (fault = guard_fault(block)) != NULL &&
+          strcmp(fault, "double free") != 0)
+        return verify_fail(fault, block + 1);
     }
+    prev = block;
   }
+  if (p != end)
+    return verify_fail("block runs past the end", prev);
+  return true;
+}
+
+static bool verify_heap(struct heap *h) {
+  uint64_t count = 0;
+  uint64_t total = 0;
+  for (struct segment *s = h->segments; s; s = s->next) {
+    char *end = (char *)s + s->size - HEADER_SIZE;
+    if (!verify_range(h, (char *)(s + 1), end, &count, &total))
+      return false;
+    if (((struct header *)end)->size != HEADER_SIZE)
+      return verify_fail("bad segment fence", end);
+  }
+  if (h->origin && !verify_range(h, h->origin, h->end, &count, &total))
+    return false;
+  if (count != h->free_count || total != h->free_total)
+    return verify_fail("free chunk count is off", NULL);
+  return true;
+}
+
+// -----------------------------
+// API
+// -----------------------------
+void allocmt(int on) {
+  static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+  threaded = on;
+  if (on)
+    pthread_once(&fork_once, fork_handlers);
+}
+
+int allocparam(enum allocparams param, uint64_t value) {
+  int res = 0;
+  heap_lock();
+  switch (param) {
+  case ALLOC_ARENAS:
+    main_heap.use_segments = value != 0;
+    break;
+  case ALLOC_MMAP_THRESHOLD:
+    mmap_threshold = value;
+    break;
+  case ALLOC_DEFER:
+    main_heap.defer_limit = value;
+    break;
+  case ALLOC_TRIM_THRESHOLD:
+    main_heap.trim_threshold = value;
+    break;
+  case ALLOC_CHECKED:
+    checked = main_heap.checked = value != 0;
+    break;
+  case ALLOC_LINEAR:
+    linear = value != 0;
+    break;
+  case ALLOC_DENSE:
+    dense = value != 0;
+    break;
+  case ALLOC_ALIGNMENT:
+    if (value == 0 || (value & (value - 1)) != 0)
+      res = -1;
+    else
+      alloc_align = value;
+    break;
+  default:
+    res = -1;
+  }
+  heap_unlock();
+  return res;
+}
+
+// Payload sizes are rounded up to alloc_align so that blocks placed one
+// after the other all stay aligned
+static uint64_t align_size(uint64_t size) {
+  return (size + alloc_align - 1) & ~(alloc_align - 1);
+}
+
+static void *alloc_block(int size, uint64_t align) {
+  if (size < 0)
+    return NULL;
+  uint64_t room = size + (checked ? GUARD_SIZE : 0);
+  void *p;
+  if (threaded && room <= TCACHE_STEP * TCACHE_CLASSES &&
+      align <= alloc_align && (mmap_threshold == 0 || room < mmap_threshold)) {
+    p = cache_alloc(room);
+  } else {
+    // Mappings start on a page, so their payloads are only HEADER_SIZE aligned
+    bool large =
+        mmap_threshold > 0 && room >= mmap_threshold && align <= HEADER_SIZE;
+    if (large)
+      p = large_alloc(room);
+    heap_lock();
+    struct allocstats *stats = &main_heap.stats;
+    if (!large)
+      p = heap_alloc(&main_heap, align_size(room), align);
+    else if (p)
+      stats->in_use +=
+          (((struct header *)p - 1)->size & ~MMAP_BIT) - HEADER_SIZE;
+    stats->allocs++;
+    stats->request_hist[hist_bucket(size)]++;
+    stats->failed += p == NULL;
+    if (stats->in_use > stats->peak_in_use)
+      stats->peak_in_use = stats->in_use;
+    heap_unlock();
+  }
+  if (checked && p)
+    guard_arm(p, size);
+  note_event(p, size);
+  return p;
+}
+
+void *alloc(int size) { return alloc_block(size, alloc_align); }
+
+void *alloc_aligned(int size, int align) {
+  if (align <= 0 || (align & (align - 1)) != 0)
+    return NULL;
+  uint64_t a = align;
+  return alloc_block(size, a > alloc_align ? a : alloc_align);
 }
 
 void dealloc(void *header) {
   if (!header)
     return;
-  deallocCalled = true;
+  if (checked)
+    guard_free(header);
+  note_event(header, -1);
   struct header *block = (struct header *)header - 1;
-  uint64_t size = block->size - sizeof(struct header);
-  block->next = head;
-  head = block;
-  printf("[dealloc] freed block, new head at %p, next block=%p, size=%lu\n",
-         block, block->next, size);
-  coalesce_unsorted();
-  /*
-    bool merged;
-    do {
-      merged = false;
-      struct header *temp = head;
-      struct header *last = NULL;
-
-      while (temp != NULL) {
-        // Forward merge
-        if (temp->next != NULL &&
-            (char *)temp + sizeof(struct header) + temp->size ==
-                (char *)temp->next + sizeof(struct header)) {
-          printf("[coalesce] Merging forward: %p(size=%lu) + %p(size=%lu)\n",
-                 temp, temp->size, temp->next, temp->next->size);
-
-          temp->size += sizeof(struct header) + temp->next->size;
-          temp->next = temp->next->next;
-          merged = true;
-        }
-
-        if (last != NULL && (char *)temp + sizeof(struct header) + temp->size ==
-                                (char *)last + sizeof(struct header)) {
-          printf("[coalesce] Merging forward2: %p(size=%lu) + %p(size=%lu)\n",
-                 temp, temp->size, last, last->size);
-
-          temp->size += last->size;
-          if (head == last) {
-            head = temp;
-          }
-          if (head->next != NULL) {
-            if (head->next->size == 0 &&
-                (char *)head + sizeof(struct header) + head->size ==
-                    (char *)head->next) {
-              head->size += sizeof(struct header);
-              head->next = NULL;
-            }
-          }
-          last = temp;
-          merged = true;
-        }
-        last = temp;
-        temp = temp->next;
-      }
-    } while (merged);
-  */
+  if (threaded && !(block->size & MMAP_BIT) && cache_free(block))
+    return;
+  heap_lock();
+  main_heap.stats.frees++;
+  if (block->size & MMAP_BIT) {
+    main_heap.stats.in_use -= (block->size & ~MMAP_BIT) - HEADER_SIZE;
+    heap_unlock();
+    large_free(block);
+    return;
+  }
+  heap_free(&main_heap, block);
+  heap_unlock();
 }
 
-void printinfo() {
-  struct header *block = head;
-  while (block != NULL) {
-    printf("[printinfo] block: %p, block size: %lu, block next: %p\n", block,
-           block->size, block->next);
-    block = block->next;
+void *realloc_block(void *ptr, int size) {
+  if (!ptr)
+    return alloc(size);
+  if (size < 0)
+    return NULL;
+  struct header *block = (struct header *)ptr - 1;
+  uint64_t old = (block->size & ~MMAP_BIT) - HEADER_SIZE;
+  uint64_t room = size + (checked ? GUARD_SIZE : 0);
+  const char *fault = checked ? guard_fault(block) : NULL;
+  if (fault)
+    guard_abort(fault, ptr);
+  bool done;
+  if (block->size & MMAP_BIT) {
+    // The mapping is kept as long as the new size fits in it
+    done = room <= old;
+  } else {
+    heap_lock();
+    done = heap_resize(&main_heap, block, align_size(room));
+    heap_unlock();
   }
+  if (checked && done)
+    guard_arm(ptr, size);
+  if (done) {
+    note_event(ptr, -1);
+    note_event(ptr, size);
+    return ptr;
+  }
+
+  void *p = alloc(size);
+  if (!p)
+    return NULL;
+  memcpy(p, ptr, old < (uint64_t)size ? old : (uint64_t)size);
+  dealloc(ptr);
+  return p;
 }
 
-void resetalloc() {
-  if (heap_origin == NULL)
+uint64_t alloc_usable(void *ptr) {
+  if (!ptr)
+    return 0;
+  struct header *block = (struct header *)ptr - 1;
+  // The red zone starts right after the size that was asked for
+  uint64_t word;
+  return checked ? *guard_word(block, &word) ^ GUARD_KEY : block_room(block);
+}
+
+static void print_chunk(const struct header *block) {
+  printf("[printinfo] block: %p, block size: %lu, block next: %p\n", block,
+         chunk_size(block), block->next);
+}
+
+void **alloc_handle(int size) {
+  if (size < 0)
+    return NULL;
+  heap_lock();
+  void **slot = handle_take();
+  struct header *p =
+      slot ? heap_alloc(&main_heap, align_size(size + sizeof(void *)),
+                        alloc_align)
+           : NULL;
+  if (p) {
+    // The hidden word goes at the very end, past any slack from the split
+    *(void ***)((char *)p + p[-1].size - HEADER_SIZE - sizeof(void *)) = slot;
+    *slot = p;
+  } else if (slot) {
+    handle_put(slot);
+    slot = NULL;
+  }
+  struct allocstats *stats = &main_heap.stats;
+  stats->allocs++;
+  stats->request_hist[hist_bucket(size)]++;
+  stats->failed += slot == NULL;
+  heap_unlock();
+  return slot;
+}
+
+void dealloc_handle(void **handle) {
+  if (!handle)
     return;
-  // printf("resetting\n");
-  void *current = sbrk(0);
-  intptr_t diff = (char *)current - (char *)heap_origin;
+  heap_lock();
+  main_heap.stats.frees++;
+  struct header *block = (struct header *)*handle - 1;
+  // A block waiting in the quick lists must not pass for a handle block
+  if (checked)
+    guard_set(block, GUARD_FREED);
+  heap_free(&main_heap, block);
+  handle_put(handle);
+  heap_unlock();
+}
 
-  if (diff > 0)
-    sbrk(-diff); // shrink heap back
-  limit = 0;
-  heap_origin = NULL;
-  heap_end = NULL;
-  head = NULL;
-  deallocCalled = false;
+int heap_verify(void) {
+  heap_lock();
+  bool ok = verify_heap(&main_heap);
+  heap_unlock();
+  if (ok)
+    return 0;
+  char buf[96];
+  int len = snprintf(buf, sizeof(buf), "alloc: heap_verify: %s at %p\n",
+                     verify_fault, verify_where);
+  write(STDERR_FILENO, buf, len);
+  return -1;
 }
 
-/* --- allocopt(): create one big allocatable region ---
-void allocopt(enum algs algopt, int size) {
-  resetalloc(); // clean any previous region
-  algs = algopt;
-  heap_origin = sbrk(0);
-  limit = size;
-  head = heap_origin;
+int alloccompact(void) {
+  heap_lock();
+  int moved = heap_compact(&main_heap);
+  heap_unlock();
+  return moved;
+}
+
+void printinfo() {
+  heap_lock();
+  chunk_walk(&main_heap, print_chunk);
+  heap_unlock();
+}
+
+void resetalloc() {
+  heap_lock();
+  // Only give the break back if nothing was put on top of our heap
+  if (main_heap.origin != NULL && sbrk(0) == main_heap.end)
+    sbrk(-((char *)main_heap.end - (char *)main_heap.origin));
+  heap_drop(&main_heap);
+  handle_drop();
+  main_heap.limit = 0;
+  main_heap.linear = linear;
+  main_heap.dense = dense;
+  heap_gen++;
+  heap_unlock();
 }
-*/
-void allocopt(enum algs algopt, int size) {
 
+void allocopt(enum algs algopt, int size) {
   resetalloc();
-  algs = algopt;
-  heap_origin = sbrk(0);
-  limit = size;
-  /*
-  struct header *block = sbrk(size);
-  block->size = size - sizeof(struct header);
-  block->next = NULL;
-  head = block;
-  */
-  heap_end = (char *)heap_origin + size;
-  // printf("[allocopt] heap_origin=%p heap_end=%p head=%p\n", heap_origin,
-  //      heap_end, head);
+  heap_lock();
+  main_heap.algs = algopt;
+  main_heap.limit = size;
+  main_heap.origin = main_heap.end = sbrk(0);
+  heap_unlock();
 }
 
-struct allocinfo allocinfo() {
-  uint64_t temp = 0;
-  uint64_t max = 0;
-  uint64_t min = UINT64_MAX;
-  uint64_t count = 0;
-  struct header *free = head;
-  while (free != NULL) {
-    count++;
-    temp += free->size;
-    if (free->size < min) {
-      min = free->size;
-    }
-    if (free->size > max) {
-      max = free->size;
-    }
-    free = free->next;
-  }
-  if (temp == 0) {
-    min = temp;
+static struct allocinfo heap_info(struct heap *h) {
+  // Sizes are the space a chunk can hand out, without its header
+  struct allocinfo info = {0, 0, 0, 0};
+  info.free_size = h->free_total - h->free_count * HEADER_SIZE;
+  info.free_chunks = h->free_count;
+  if (h->free_count > 0) {
+    info.largest_free_chunk_size = chunk_size(largest_chunk(h)) - HEADER_SIZE;
+    info.smallest_free_chunk_size =
+        chunk_size(smallest_chunk(h)) - HEADER_SIZE;
   }
-  if (temp == limit) {
-    temp -= sizeof(struct header);
-  }
-  struct allocinfo info;
-  info.free_size = temp;
-  info.free_chunks = count;
-  info.largest_free_chunk_size = max;
-  info.smallest_free_chunk_size = min;
   return info;
 }
+
+struct allocinfo allocinfo() {
+  heap_lock();
+  struct allocinfo info = heap_info(&main_heap);
+  heap_unlock();
+  return info;
+}
+
+struct allocstats allocstats(void) {
+  heap_lock();
+  // Other threads' caches add theirs the next time they take the lock
+  if (threaded)
+    cache_count();
+  struct heap *h = &main_heap;
+  struct allocstats res = h->stats;
+  res.heap_size = heap_bytes(h);
+  uint64_t free_size = h->free_total - h->free_count * HEADER_SIZE;
+  // Share of the free space that a single allocation cannot use
+  res.fragmentation =
+      free_size ? 1.0 - (double)(chunk_size(largest_chunk(h)) - HEADER_SIZE) /
+                            free_size
+                : 0.0;
+  heap_unlock();
+  return res;
+}
+
+// -----------------------------
+// ARENA HANDLES
+// -----------------------------
+// An arena is a heap of its own that grows by segments. The heap lives in a
+// mapping of its own, so an arena never allocates from another heap.
+struct arena {
+  struct heap heap;
+};
+
+struct arena *arena_create(enum algs algopt, int size) {
+  if ((unsigned)algopt > TLSF)
+    return NULL;
+  struct arena *arena = mmap(NULL, page_round(sizeof(struct arena)),
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (arena == MAP_FAILED) {
+    perror("mmap failed");
+    return NULL;
+  }
+  // The mapping comes zeroed, which is an empty heap
+  arena->heap.algs = algopt;
+  arena->heap.limit = size;
+  arena->heap.use_segments = true;
+  arena->heap.segment_next = SEGMENT_MIN;
+  // arena_alloc() adds no guards, so the blocks have none to keep clear
+  arena->heap.defer_limit = main_heap.defer_limit;
+  arena->heap.trim_threshold = main_heap.trim_threshold;
+  return arena;
+}
+
+void *arena_alloc(struct arena *arena, int size) {
+  if (size < 0)
+    return NULL;
+  struct heap *h = &arena->heap;
+  void *p = heap_alloc(h, align_size(size), alloc_align);
+  h->stats.allocs++;
+  h->stats.request_hist[hist_bucket(size)]++;
+  h->stats.failed += p == NULL;
+  return p;
+}
+
+void arena_free(struct arena *arena, void *ptr) {
+  if (!ptr)
+    return;
+  arena->heap.stats.frees++;
+  heap_free(&arena->heap, (struct header *)ptr - 1);
+}
+
+void arena_reset(struct arena *arena) { heap_drop(&arena->heap); }
+
+void arena_destroy(struct arena *arena) {
+  heap_drop(&arena->heap);
+  if (arena->heap.dense_sizes)
+    munmap(arena->heap.dense_sizes, dense_bytes(arena->heap.dense_cap));
+  munmap(arena, page_round(sizeof(struct arena)));
+}
+
+struct allocinfo arena_info(struct arena *arena) {
+  return heap_info(&arena->heap);
+}
@@ -4,6 +4,17 @@
 
 #define INCREMENT 256
 
+#define ALLOC_HIST_BUCKETS 32
+
+/*
+ * Build alloc.c with -DALLOC_TRACE_LEVEL=1 to keep the last alloc() and
+ * dealloc() calls in memory for alloctrace_dump(), or 2 to also print every
+ * block the heap hands out and takes back. 0 (default) traces nothing.
+ */
+#ifndef ALLOC_TRACE_LEVEL
+#define ALLOC_TRACE_LEVEL 0
+#endif
+
 /*
  * This is the header for each allocated memory used internally by the
  * allocator. The test cases use this too to get the size of the header.
@@ -18,7 +29,45 @@ struct header {
 /*
  * Allocation algorithm options
  */
-enum algs { FIRST_FIT, BEST_FIT, WORST_FIT };
+enum algs {
+  FIRST_FIT,
+  BEST_FIT,
+  WORST_FIT,
+  TLSF // two-level segregated fit: alloc() and dealloc() take bounded time
+};
+
+/*
+ * Parameters for allocparam()
+ */
+enum allocparams {
+  ALLOC_ARENAS,        // non-zero: grow the heap by mmap'd segments, not sbrk
+  ALLOC_MMAP_THRESHOLD, // allocations of at least this many bytes get their
+                        // own mapping, unmapped by dealloc(); 0 (default) is
+                        // off
+  ALLOC_ALIGNMENT, // power of two that alloc() payloads are aligned to and
+                   // their sizes rounded up to; 1 (default) packs blocks
+  ALLOC_DEFER, // non-zero: dealloc() keeps small blocks in lists by size
+               // for alloc() to reuse as they are, and merges them with
+               // their neighbours once this many wait or when an alloc()
+               // finds no free chunk; 0 (default) merges on every
+               // dealloc(). Waiting blocks are not counted as free by
+               // allocinfo()
+  ALLOC_TRIM_THRESHOLD, // free chunks of at least this many bytes give
+                        // their pages back to the system: the top of the
+                        // heap is cut off, or in segments the pages are
+                        // dropped; 0 (default) is off
+  ALLOC_CHECKED, // non-zero: every block from alloc() is followed by a red
+                // zone that dealloc() and realloc_block() check, and a
+                // dealloc() of a freed block is caught; either aborts with
+                // a message on stderr. Set it before the first alloc()
+  ALLOC_LINEAR, // non-zero: free chunks are kept in one list that every
+                // alloc() scans with the algorithm's rule, instead of an
+                // index; from the next allocopt() or resetalloc()
+  ALLOC_DENSE   // non-zero: the sizes of the free chunks are kept in one
+                // array that alloc() scans several at a time with the
+                // algorithm's rule; it takes precedence over ALLOC_LINEAR.
+                // From the next allocopt() or resetalloc()
+};
 
 /*
  * Allocation statistics. The test cases only use free_size, but other fields
@@ -31,6 +80,30 @@ struct allocinfo {
   uint64_t smallest_free_chunk_size;
 };
 
+/*
+ * Counters kept since the last resetalloc(). Sizes are payload bytes; bucket
+ * b of a histogram counts sizes in [2^b, 2^(b+1)), the last bucket takes
+ * everything bigger. In thread-safe mode, calls served from a thread's cache
+ * are added the next time that thread takes the heap lock.
+ */
+struct allocstats {
+  uint64_t in_use;         // bytes handed out and not yet freed, blocks
+                           // in the allocmt() caches included
+  uint64_t peak_in_use;    // highest in_use
+  uint64_t heap_size;      // bytes taken from the system for the heap
+  uint64_t peak_heap_size; // highest heap_size
+  uint64_t allocs;         // alloc() calls
+  uint64_t frees;          // dealloc() calls
+  uint64_t failed;         // alloc() calls that returned NULL
+  uint64_t splits;         // free chunks split to serve an allocation
+  uint64_t merges;         // free chunks merged with a freed block
+  uint64_t grows;          // times the heap was grown
+  uint64_t trims;          // times pages were given back to the system
+  uint64_t request_hist[ALLOC_HIST_BUCKETS]; // alloc() sizes
+  uint64_t free_hist[ALLOC_HIST_BUCKETS];    // current free chunk sizes
+  double fragmentation; // 1 - largest free chunk / free bytes
+};
+
 /*
  * alloc() allocates memory from the heap. The first argument indicates the
  * size. It returns the pointer to the newly-allocated memory. It returns NULL
@@ -43,6 +116,60 @@ void *alloc(int);
  */
 void dealloc(void *);
 
+/*
+ * alloc_aligned() is alloc() with the payload aligned to the second argument,
+ * a power of two. It returns NULL if the alignment is not one.
+ */
+void *alloc_aligned(int, int);
+
+/*
+ * realloc_block() changes the size of the block pointed to by the first
+ * argument to the second argument and returns the block. It grows in place
+ * when the free chunk after the block is big enough, or when the block is at
+ * the top of the heap; otherwise it moves the contents to a new block with
+ * alloc()'s alignment and frees the old one. It returns NULL and leaves the
+ * block alone if there is not enough space. A NULL block is alloc().
+ */
+void *realloc_block(void *, int);
+
+/*
+ * alloc_usable() returns how many bytes the block from alloc(),
+ * alloc_aligned() or realloc_block() can hold, at least the size it was
+ * asked for; with ALLOC_CHECKED exactly that size. A NULL block holds 0.
+ */
+uint64_t alloc_usable(void *);
+
+/*
+ * alloc_handle() is alloc() through a handle: the block is at *handle, and
+ * alloccompact() may move it, so *handle has to be read again after every
+ * alloccompact(). It returns NULL if there is not enough space. The block
+ * ends with one hidden pointer past its size.
+ */
+void **alloc_handle(int);
+
+/*
+ * dealloc_handle() frees the block of a handle and the handle itself.
+ */
+void dealloc_handle(void **);
+
+/*
+ * alloccompact() slides the blocks allocated by alloc_handle() toward the
+ * start of the heap, over the free chunks in front of them, and updates
+ * their handles. Free space between them merges into bigger chunks; blocks
+ * from alloc() stay where they are and keep the free space around them
+ * apart. It returns the number of blocks moved.
+ */
+int alloccompact(void);
+
+/*
+ * heap_verify() walks every block of the heap and checks the boundary tags,
+ * the links of every free chunk in its index and the free chunk counts, and
+ * with ALLOC_CHECKED the red zone of every allocated block. It returns 0 if
+ * the heap is sound; otherwise it writes the first problem to stderr and
+ * returns -1. In thread-safe mode, call it while no other thread allocates.
+ */
+int heap_verify(void);
+
 void printinfo();
 
 void resetalloc();
@@ -54,7 +181,90 @@ void resetalloc();
  */
 void allocopt(enum algs, int);
 
+/*
+ * allocparam() sets one of the allocator parameters. They are kept across
+ * allocopt() and resetalloc(). It returns 0 on success and -1 if the
+ * parameter is unknown.
+ */
+int allocparam(enum allocparams, uint64_t);
+
 /*
  * allocinfo() returns the current statistics.
  */
 struct allocinfo allocinfo(void);
+
+/*
+ * allocstats() returns the counters above. With allocmt() on, the calls
+ * other threads' caches served are added when those threads next take the
+ * heap lock: to refill or flush a cache, or on thread exit.
+ */
+struct allocstats allocstats(void);
+
+/*
+ * alloctrace() starts writing every alloc() and dealloc() to the file at
+ * path, one per line: "a <address> <size>" and "f <address>", addresses in
+ * hex. A NULL path stops tracing and flushes the file. It returns 0 on
+ * success and -1 if the file cannot be opened.
+ */
+int alloctrace(const char *);
+
+/*
+ * alloctrace_dump() writes the calls kept in memory to the file descriptor,
+ * oldest first, in the format of alloctrace(). It does not lock, so it can
+ * be called while other threads allocate. It returns the number of calls
+ * written, always 0 with ALLOC_TRACE_LEVEL 0, or -1 if writing fails.
+ */
+int alloctrace_dump(int);
+
+/*
+ * allocmt() makes the allocator thread-safe when the argument is non-zero.
+ * Each thread then caches small blocks and only takes the heap lock to move
+ * them in batches; cached blocks are not counted as free by allocinfo().
+ * Call it before starting the threads that allocate.
+ */
+void allocmt(int);
+
+/*
+ * An arena is a heap of its own, apart from the one alloc() uses. Blocks are
+ * allocated and freed one by one like with alloc(), and dropped all at once
+ * by arena_reset() or arena_destroy(), which give the arena's memory back to
+ * the system without looking at its blocks. An arena is not thread-safe:
+ * only one thread may use it at a time.
+ */
+struct arena;
+
+/*
+ * arena_create() makes an empty arena. The arguments are the ones of
+ * allocopt(): the algorithm and the size limit, 0 for none. The arena keeps
+ * the ALLOC_DEFER and ALLOC_TRIM_THRESHOLD values set at this call. It
+ * returns NULL if the algorithm is not one of enum algs or there is not
+ * enough memory.
+ */
+struct arena *arena_create(enum algs, int);
+
+/*
+ * arena_alloc() is alloc() from the arena, with the alignment set by
+ * ALLOC_ALIGNMENT. Blocks are never given their own mapping.
+ */
+void *arena_alloc(struct arena *, int);
+
+/*
+ * arena_free() frees a block allocated from the arena.
+ */
+void arena_free(struct arena *, void *);
+
+/*
+ * arena_reset() frees every block of the arena at once. The arena keeps its
+ * algorithm and limit.
+ */
+void arena_reset(struct arena *);
+
+/*
+ * arena_destroy() frees every block of the arena and the arena itself.
+ */
+void arena_destroy(struct arena *);
+
+/*
+ * arena_info() is allocinfo() for the arena.
+ */
+struct allocinfo arena_info(struct arena *);
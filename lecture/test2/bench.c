@@ -0,0 +1,308 @@
+#define _DEFAULT_SOURCE
+
+#include "alloc.h"
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Replays alloc/dealloc traces through each allocation policy and through
+// the system malloc, e.g.
+//   ./bench                 the synthetic traces below
+//   ./bench trace.txt ...   traces written by alloctrace()
+
+#define OPS 200000
+#define LIVE 4096    // live blocks in the churn traces
+#define QUEUE 1024   // messages in flight in the producer/consumer trace
+#define SAMPLE 256   // ops between peak heap samples of the system malloc
+
+// One trace step: size >= 0 allocates block id, size < 0 frees it
+struct op {
+  uint32_t id;
+  int32_t size;
+};
+
+struct trace {
+  const char *name;
+  struct op *ops;
+  size_t count;
+  size_t cap;
+  size_t ids; // number of distinct blocks
+};
+
+struct result {
+  double ops_per_sec;
+  uint64_t p99_ns;
+  uint64_t peak_heap;
+  double fragmentation; // negative if unknown
+};
+
+static bool trace_push(struct trace *t, uint32_t id, int32_t size) {
+  if (t->count == t->cap) {
+    size_t cap = t->cap ? t->cap * 2 : 1024;
+    struct op *ops = realloc(t->ops, sizeof(struct op) * cap);
+    if (!ops)
+      return false;
+    t->ops = ops;
+    t->cap = cap;
+  }
+  t->ops[t->count++] = (struct op){id, size};
+  return true;
+}
+
+// -----------------------------
+// SYNTHETIC TRACES
+// -----------------------------
+// Random sizes in [lo, hi]
+static int32_t rand_size(unsigned int *seed, int32_t lo, int32_t hi) {
+  return lo + rand_r(seed) % (hi - lo + 1);
+}
+
+// Steady state: LIVE blocks, each step frees a random one and replaces it
+// bimodal mixes mostly small blocks with a few page-sized ones
+static void gen_churn(struct trace *t, bool bimodal) {
+  unsigned int seed = bimodal ? 2 : 1;
+  uint32_t live[LIVE];
+  for (size_t i = 0; i < OPS / 2; i++) {
+    size_t slot = i < LIVE ? i : (size_t)rand_r(&seed) % LIVE;
+    if (i >= LIVE)
+      trace_push(t, live[slot], -1);
+    int32_t size = !bimodal                ? rand_size(&seed, 16, 512)
+                   : rand_r(&seed) % 10 > 0 ? rand_size(&seed, 16, 64)
+                                           : rand_size(&seed, 4096, 32768);
+    live[slot] = t->ids++;
+    trace_push(t, live[slot], size);
+  }
+}
+
+// Messages are allocated by a producer and freed in order by a consumer
+static void gen_prodcons(struct trace *t) {
+  unsigned int seed = 3;
+  for (size_t i = 0; i < OPS / 2; i++) {
+    if (i >= QUEUE)
+      trace_push(t, i - QUEUE, -1);
+    trace_push(t, t->ids++, rand_size(&seed, 32, 256));
+  }
+}
+
+// -----------------------------
+// RECORDED TRACES
+// -----------------------------
+// Open addressing from a live address to its block id, 0 marks an empty
+// slot and 1 a deleted one
+struct addr_map {
+  uintptr_t *addr;
+  uint32_t *id;
+  size_t mask;
+};
+
+static size_t addr_find(struct addr_map *m, uintptr_t addr, bool insert) {
+  size_t i = (addr >> 4) * 0x9E3779B97F4A7C15ull & m->mask;
+  size_t tomb = SIZE_MAX;
+  while (m->addr[i] != 0 && m->addr[i] != addr) {
+    if (m->addr[i] == 1 && tomb == SIZE_MAX)
+      tomb = i;
+    i = (i + 1) & m->mask;
+  }
+  return insert && m->addr[i] != addr && tomb != SIZE_MAX ? tomb : i;
+}
+
+// Reads a file written by alloctrace(); failed allocations are dropped
+static bool load_trace(struct trace *t, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  size_t lines = 0;
+  for (int c; (c = fgetc(f)) != EOF;)
+    lines += c == '\n';
+  rewind(f);
+
+  struct addr_map m;
+  for (m.mask = 1; m.mask < lines * 2; m.mask *= 2)
+    ;
+  m.addr = calloc(m.mask, sizeof(uintptr_t));
+  m.id = malloc(m.mask * sizeof(uint32_t));
+  m.mask--;
+  bool ok = m.addr && m.id;
+
+  char kind;
+  unsigned long addr;
+  while (ok && fscanf(f, " %c %lx", &kind, &addr) == 2) {
+    int size = 0;
+    if (kind == 'a' && fscanf(f, "%d", &size) != 1)
+      ok = false;
+    if (!ok || addr == 0)
+      continue;
+    if (kind == 'a') {
+      size_t i = addr_find(&m, addr, true);
+      m.addr[i] = addr;
+      m.id[i] = t->ids;
+      ok = trace_push(t, t->ids++, size);
+    } else {
+      size_t i = addr_find(&m, addr, false);
+      if (m.addr[i] == addr) {
+        m.addr[i] = 1;
+        ok = trace_push(t, m.id[i], -1);
+      }
+    }
+  }
+  free(m.addr);
+  free(m.id);
+  fclose(f);
+  return ok;
+}
+
+// -----------------------------
+// REPLAY
+// -----------------------------
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t malloc_heap(void) {
+  struct mallinfo2 mi = mallinfo2();
+  return mi.arena + mi.hblkhd;
+}
+
+// alg < 0 replays through malloc() and free()
+static struct result replay(const struct trace *t, int alg) {
+  void **blocks = calloc(t->ids, sizeof(void *));
+  uint64_t *lat = malloc(sizeof(uint64_t) * t->count);
+  struct result res = {0, 0, 0, -1};
+  if (!blocks || !lat) {
+    free(blocks);
+    free(lat);
+    return res;
+  }
+  if (alg >= 0) {
+    allocopt(alg, 0);
+    resetalloc();
+  }
+
+  // The bench's own buffers come from malloc() too
+  uint64_t base = alg < 0 ? malloc_heap() : 0;
+  uint64_t total = 0;
+  for (size_t i = 0; i < t->count; i++) {
+    const struct op *op = &t->ops[i];
+    uint64_t start = now_ns();
+    if (op->size >= 0)
+      blocks[op->id] = alg < 0 ? malloc(op->size) : alloc(op->size);
+    else if (alg < 0)
+      free(blocks[op->id]);
+    else
+      dealloc(blocks[op->id]);
+    lat[i] = now_ns() - start;
+    total += lat[i];
+    if (op->size < 0)
+      blocks[op->id] = NULL;
+    if (alg < 0 && i % SAMPLE == 0 && malloc_heap() > base + res.peak_heap)
+      res.peak_heap = malloc_heap() - base;
+  }
+
+  res.ops_per_sec = total ? t->count * 1e9 / total : 0;
+  qsort(lat, t->count, sizeof(uint64_t), cmp_u64);
+  res.p99_ns = t->count ? lat[t->count * 99 / 100] : 0;
+  if (alg >= 0) {
+    struct allocstats st = allocstats();
+    res.peak_heap = st.peak_heap_size;
+    res.fragmentation = st.fragmentation;
+  }
+
+  // Blocks still live at the end of the trace
+  for (size_t id = 0; id < t->ids; id++) {
+    if (alg < 0)
+      free(blocks[id]);
+    else
+      dealloc(blocks[id]);
+  }
+  if (alg >= 0)
+    resetalloc();
+  free(blocks);
+  free(lat);
+  return res;
+}
+
+// Every replay gets a child of its own, so malloc() does not start with
+// the arena an earlier trace left behind, and the allocator can grow by the
+// break, in INCREMENTs rather than whole segments, as nothing else moves it
+// while the trace runs
+static struct result replay_fresh(const struct trace *t, int alg) {
+  struct result res = {0, 0, 0, -1};
+  int fds[2];
+  if (pipe(fds) != 0)
+    return res;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    res = replay(t, alg);
+    write(fds[1], &res, sizeof(res));
+    _exit(0);
+  }
+  close(fds[1]);
+  if (pid < 0 || read(fds[0], &res, sizeof(res)) != sizeof(res))
+    res = (struct result){0, 0, 0, -1};
+  close(fds[0]);
+  if (pid > 0)
+    waitpid(pid, NULL, 0);
+  return res;
+}
+
+static void run(const struct trace *t) {
+  static const char *names[] = {"FIRST_FIT", "BEST_FIT", "WORST_FIT",
+                                "TLSF"};
+  printf("%s: %zu ops\n", t->name, t->count);
+  printf("  %-10s %12s %8s %12s %6s\n", "policy", "ops/sec", "p99 ns",
+         "peak heap", "frag");
+  for (int alg = -1; alg <= TLSF; alg++) {
+    struct result res = replay_fresh(t, alg);
+    printf("  %-10s %12.0f %8lu %12lu ", alg < 0 ? "malloc" : names[alg],
+           res.ops_per_sec, res.p99_ns, res.peak_heap);
+    if (res.fragmentation < 0)
+      printf("%6s\n", "-");
+    else
+      printf("%6.3f\n", res.fragmentation);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int status = 0;
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      struct trace t = {argv[i], NULL, 0, 0, 0};
+      if (load_trace(&t, argv[i])) {
+        run(&t);
+      } else {
+        fprintf(stderr, "bench: cannot read %s\n", argv[i]);
+        status = 1;
+      }
+      free(t.ops);
+    }
+    return status;
+  }
+
+  struct trace traces[] = {{"churn", NULL, 0, 0, 0},
+                           {"producer/consumer", NULL, 0, 0, 0},
+                           {"bimodal", NULL, 0, 0, 0}};
+  gen_churn(&traces[0], false);
+  gen_prodcons(&traces[1]);
+  gen_churn(&traces[2], true);
+  for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+    run(&traces[i]);
+    free(traces[i].ops);
+  }
+  return status;
+}
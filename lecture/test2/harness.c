@@ -0,0 +1,201 @@
+#define _DEFAULT_SOURCE
+
+#include "alloc.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Runs the main2.c or main3.c scenarios, a scaled-up version of them and
+// the same pattern in many small heaps against each allocator strategy, e.g.
+//   ./harness2 [repeats]    main2.c's scenarios
+//   ./harness3 [repeats]    main3.c's scenarios
+// The scenario file is linked in with its main() renamed to scenario_main().
+
+#define SCALE 20000 // blocks in the scaled-up scenario
+#define SMALL 16     // blocks in each heap of the small-heap run
+#define ROUNDS 20000 // heaps in the small-heap run
+
+int scenario_main(int argc, char *argv[]);
+
+struct strategy {
+  const char *name;
+  bool linear; // ALLOC_LINEAR: one list scanned by every alloc()
+  bool dense;  // ALLOC_DENSE: one array of sizes scanned with vectors
+  bool cache;  // allocmt(): per-thread caches of small blocks
+};
+
+static const struct strategy strategies[] = {
+    {"indexed", false, false, false}, {"indexed+cache", false, false, true},
+    {"linear", true, false, false},   {"linear+cache", true, false, true},
+    {"dense", false, true, false},    {"dense+cache", false, true, true}};
+
+#define STRATEGY_COUNT (sizeof(strategies) / sizeof(strategies[0]))
+
+static void use_strategy(const struct strategy *s) {
+  allocparam(ALLOC_LINEAR, s->linear);
+  allocparam(ALLOC_DENSE, s->dense);
+  allocmt(s->cache);
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// -----------------------------
+// SCENARIOS
+// -----------------------------
+// The scenarios check sbrk() and count their cases in globals, so each run
+// gets a child of its own; the parent reads the last score line it prints.
+// Returns false if the child did not exit normally or all its cases did
+// not pass
+static bool run_scenarios(const struct strategy *s, int repeats, int *passed,
+                          int *total, double *ms) {
+  *passed = *total = 0;
+  *ms = 0;
+  int fds[2];
+  if (pipe(fds) != 0)
+    return false;
+  fflush(stdout);
+  double start = now_ms();
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    use_strategy(s);
+    char *argv[] = {"scenario", NULL};
+    for (int i = 0; i < repeats; i++)
+      scenario_main(1, argv);
+    exit(0);
+  }
+
+  close(fds[1]);
+  FILE *f = fdopen(fds[0], "r");
+  char line[128];
+  while (f && fgets(line, sizeof(line), f))
+    sscanf(line, "Score: %*d, Success cases: %d/%d", passed, total);
+  if (f)
+    fclose(f);
+  else
+    close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  *ms = now_ms() - start;
+  // The cases pile up across repeats, the total does not
+  *total *= repeats;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 && *passed == *total;
+}
+
+// -----------------------------
+// SCALED UP
+// -----------------------------
+// The scenarios' pattern with SCALE blocks: fill the heap, free every other
+// block and allocate into the holes. Returns the time of the last step
+static double run_scaled(const struct strategy *s, enum algs alg) {
+  static void *blocks[SCALE];
+  unsigned int seed = 1;
+  use_strategy(s);
+  allocopt(alg, 0);
+  for (size_t i = 0; i < SCALE; i++)
+    blocks[i] = alloc(16 + rand_r(&seed) % 512);
+  for (size_t i = 0; i < SCALE; i += 2) {
+    dealloc(blocks[i]);
+    blocks[i] = NULL;
+  }
+
+  double start = now_ms();
+  for (size_t i = 0; i < SCALE; i += 2)
+    blocks[i] = alloc(16 + rand_r(&seed) % 256);
+  double ms = now_ms() - start;
+
+  for (size_t i = 0; i < SCALE; i++)
+    dealloc(blocks[i]);
+  resetalloc();
+  return ms;
+}
+
+// -----------------------------
+// SMALL HEAPS
+// -----------------------------
+// The same pattern in ROUNDS heaps of SMALL blocks, the size of the
+// scenarios' heaps. Returns the time of all of it, as setting up and
+// dropping each heap counts here
+static double run_small(const struct strategy *s, enum algs alg) {
+  void *blocks[SMALL];
+  unsigned int seed = 1;
+  use_strategy(s);
+  double start = now_ms();
+  for (int r = 0; r < ROUNDS; r++) {
+    allocopt(alg, 0);
+    for (size_t i = 0; i < SMALL; i++)
+      blocks[i] = alloc(16 + rand_r(&seed) % 32);
+    for (size_t i = 0; i < SMALL; i += 2)
+      dealloc(blocks[i]);
+    for (size_t i = 0; i < SMALL; i += 2)
+      blocks[i] = alloc(16 + rand_r(&seed) % 16);
+    for (size_t i = 0; i < SMALL; i++)
+      dealloc(blocks[i]);
+  }
+  double ms = now_ms() - start;
+  resetalloc();
+  return ms;
+}
+
+int main(int argc, char *argv[]) {
+  int repeats = argc > 1 ? atoi(argv[1]) : 10;
+  if (repeats < 1)
+    repeats = 1;
+
+  // The scenarios check exact block sizes in heaps of a few hundred bytes.
+  // The caches round sizes up and take blocks in batches, so those heaps
+  // run out, and the scenarios do not check what alloc() returns; the
+  // cached strategies are only compared in the scaled-up run
+  int status = 0;
+  printf("scenarios x%d\n", repeats);
+  printf("  %-14s %12s %10s\n", "strategy", "cases", "ms");
+  for (size_t i = 0; i < STRATEGY_COUNT; i++) {
+    if (strategies[i].cache) {
+      printf("  %-14s %12s %10s  skipped: sizes rounded up\n",
+             strategies[i].name, "-", "-");
+      continue;
+    }
+    int passed, total;
+    double ms;
+    if (!run_scenarios(&strategies[i], repeats, &passed, &total, &ms))
+      status = 1;
+    printf("  %-14s %5d/%-6d %10.1f\n", strategies[i].name, passed, total, ms);
+  }
+
+  // From here on the allocator runs in this process, next to malloc()
+  allocparam(ALLOC_ARENAS, 1);
+  printf("scaled up, %d blocks (ms)\n", SCALE);
+  printf("  %-14s %10s %10s %10s %10s\n", "strategy", "FIRST_FIT", "BEST_FIT",
+         "WORST_FIT", "TLSF");
+  for (size_t i = 0; i < STRATEGY_COUNT; i++) {
+    printf("  %-14s", strategies[i].name);
+    for (int alg = FIRST_FIT; alg <= TLSF; alg++)
+      printf(" %10.2f", run_scaled(&strategies[i], alg));
+    printf("\n");
+  }
+
+  printf("small heaps, %d of %d blocks (ms)\n", ROUNDS, SMALL);
+  printf("  %-14s %10s %10s %10s %10s\n", "strategy", "FIRST_FIT", "BEST_FIT",
+         "WORST_FIT", "TLSF");
+  for (size_t i = 0; i < STRATEGY_COUNT; i++) {
+    printf("  %-14s", strategies[i].name);
+    for (int alg = FIRST_FIT; alg <= TLSF; alg++)
+      printf(" %10.2f", run_small(&strategies[i], alg));
+    printf("\n");
+  }
+  return status;
+}
@@ -0,0 +1,703 @@
+#define _DEFAULT_SOURCE
+
+#include "alloc.h"
+#include "pool.h"
+#include "region.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define HEADER_SIZE (sizeof(struct header))
+#define THREADS 8
+#define SLOTS 64
+
+static int SUCCESS_CASES = 0;
+static int TOTAL_CASES = 41;
+static int TOTAL_SCORE = 0;
+
+void print_test_result() {
+  char buf[48];
+  snprintf(buf, 48, "Score: %d, Success cases: %d/%d\n", TOTAL_SCORE,
+           SUCCESS_CASES, TOTAL_CASES);
+  write(STDOUT_FILENO, buf, strlen(buf));
+}
+
+void TEST(int line, bool f, int pts) {
+  if (f) {
+    SUCCESS_CASES += 1;
+    TOTAL_SCORE += pts;
+  } else {
+    char buf[32];
+    snprintf(buf, 32, "Test failed at line %d\n", line);
+    write(STDOUT_FILENO, buf, strlen(buf));
+  }
+  print_test_result();
+}
+
+void *churn(void *arg) {
+  unsigned int seed = (unsigned int)(size_t)arg;
+  char *p[SLOTS] = {NULL};
+  int sz[SLOTS];
+  bool ok = true;
+  for (int r = 0; r < 20000; r++) {
+    int i = rand_r(&seed) % SLOTS;
+    if (p[i] != NULL) {
+      for (int k = 0; k < sz[i]; k++)
+        ok = ok && p[i][k] == (char)(i + k);
+      dealloc(p[i]);
+      p[i] = NULL;
+    } else {
+      sz[i] = rand_r(&seed) % 8 == 0 ? rand_r(&seed) % 1000 : rand_r(&seed) % 200;
+      p[i] = alloc(sz[i]);
+      if (p[i] == NULL)
+        return NULL;
+      for (int k = 0; k < sz[i]; k++)
+        p[i][k] = (char)(i + k);
+    }
+  }
+  for (int i = 0; i < SLOTS; i++)
+    dealloc(p[i]);
+  return ok ? arg : NULL;
+}
+
+void *produce(void *arg) {
+  void **p = arg;
+  for (int i = 0; i < SLOTS; i++)
+    p[i] = alloc(32 + HEADER_SIZE * (i % 4));
+  return NULL;
+}
+
+void *consume(void *arg) {
+  void **p = arg;
+  for (int i = 0; i < SLOTS; i++)
+    dealloc(p[i]);
+  void *q = alloc(32);
+  dealloc(q);
+  return q;
+}
+
+void test_threads() {
+  allocopt(FIRST_FIT, 0);
+  allocmt(1);
+
+  pthread_t threads[THREADS];
+  for (size_t t = 0; t < THREADS; t++)
+    pthread_create(&threads[t], NULL, churn, (void *)(t + 1));
+  bool ok = true;
+  for (size_t t = 0; t < THREADS; t++) {
+    void *res;
+    pthread_join(threads[t], &res);
+    ok = ok && res == (void *)(t + 1);
+  }
+  TEST(__LINE__, ok, 5);
+
+  // Blocks freed by another thread go to that thread's cache
+  void *p[SLOTS];
+  void *res;
+  pthread_t thread;
+  pthread_create(&thread, NULL, produce, p);
+  pthread_join(thread, NULL);
+  pthread_create(&thread, NULL, consume, p);
+  pthread_join(thread, &res);
+  TEST(__LINE__, res != NULL, 2);
+
+  // Exited threads gave their caches back, so the heap is one chunk again
+  allocmt(0);
+  struct allocinfo info = allocinfo();
+  TEST(__LINE__, info.free_chunks == 1, 2);
+}
+
+void test_arenas() {
+  allocparam(ALLOC_ARENAS, 1);
+  allocopt(BEST_FIT, 0);
+  char *base = sbrk(0);
+  void *p[1000];
+  bool ok = true;
+  for (int i = 0; i < 1000; i++) {
+    p[i] = alloc(100);
+    ok = ok && p[i] != NULL;
+    if (p[i])
+      memset(p[i], i, 100);
+  }
+  TEST(__LINE__, ok && sbrk(0) == base, 2);
+
+  // Arenas double, so 100 KB fits in two of them, each one free chunk again
+  for (int i = 0; i < 1000; i++)
+    dealloc(p[i]);
+  struct allocinfo info = allocinfo();
+  TEST(__LINE__, info.free_chunks == 2, 2);
+
+  // Large blocks are mapped on their own and leave the heap alone
+  allocparam(ALLOC_MMAP_THRESHOLD, 64 * 1024);
+  char *big = alloc(1 << 20);
+  ok = big != NULL;
+  if (big)
+    memset(big, 1, 1 << 20);
+  TEST(__LINE__, ok && allocinfo().free_size == info.free_size, 2);
+  dealloc(big);
+  TEST(__LINE__, allocinfo().free_size == info.free_size, 1);
+
+  allocparam(ALLOC_MMAP_THRESHOLD, 0);
+  allocparam(ALLOC_ARENAS, 0);
+  resetalloc();
+}
+
+void test_pool() {
+  struct pool *pool = pool_create(24, 0);
+  void *p[10000];
+  bool ok = pool != NULL;
+  for (int i = 0; ok && i < 10000; i++) {
+    p[i] = pool_alloc(pool);
+    ok = p[i] != NULL && (uintptr_t)p[i] % sizeof(void *) == 0;
+    if (ok)
+      memset(p[i], i, 24);
+  }
+  for (int i = 0; ok && i < 10000; i++)
+    ok = ((unsigned char *)p[i])[23] == (unsigned char)i;
+  TEST(__LINE__, ok, 2);
+
+  // Freed blocks are handed out again, last freed first
+  pool_free(pool, p[10]);
+  pool_free(pool, p[20]);
+  TEST(__LINE__, pool_alloc(pool) == p[20] && pool_alloc(pool) == p[10], 2);
+  pool_destroy(pool);
+
+  pool = pool_create(40, 64);
+  ok = pool != NULL;
+  for (int i = 0; ok && i < 100; i++) {
+    p[i] = pool_alloc(pool);
+    ok = p[i] != NULL && (uintptr_t)p[i] % 64 == 0;
+  }
+  TEST(__LINE__, ok, 1);
+  pool_destroy(pool);
+}
+
+void test_stats() {
+  allocopt(BEST_FIT, 0);
+  void *a = alloc(100);
+  void *b = alloc(1000);
+  void *c = alloc(100);
+  struct allocstats st = allocstats();
+  TEST(__LINE__,
+       st.allocs == 3 && st.in_use >= 1200 && st.peak_in_use == st.in_use &&
+           st.request_hist[6] == 2 && st.request_hist[9] == 1 &&
+           st.heap_size == st.peak_heap_size && st.grows > 0,
+       2);
+
+  // One hole in front of the top chunk: half the free space is stuck there
+  dealloc(b);
+  st = allocstats();
+  struct allocinfo info = allocinfo();
+  TEST(__LINE__,
+       st.frees == 1 && st.in_use < st.peak_in_use && info.free_chunks == 2 &&
+           st.fragmentation ==
+               1.0 - (double)info.largest_free_chunk_size / info.free_size,
+       2);
+  dealloc(a);
+  dealloc(c);
+  TEST(__LINE__, allocstats().in_use == 0 && allocstats().merges >= 2, 1);
+
+  char path[] = "/tmp/alloc_trace_XXXXXX";
+  int fd = mkstemp(path);
+  bool ok = fd >= 0 && alloctrace(path) == 0;
+  a = alloc(64);
+  dealloc(a);
+  ok = ok && alloctrace(NULL) == 0;
+  char buf[128] = {0};
+  char want[128];
+  snprintf(want, 128, "a %lx 64\nf %lx\n", (unsigned long)(uintptr_t)a,
+           (unsigned long)(uintptr_t)a);
+  ok = ok && read(fd, buf, 127) > 0 && strcmp(buf, want) == 0;
+  close(fd);
+  unlink(path);
+  TEST(__LINE__, ok, 1);
+
+  // Calls the cache served are counted too, and the blocks it keeps stay in
+  // use; 8-byte requests get 16-byte payloads
+  allocmt(1);
+  allocopt(BEST_FIT, 0);
+  for (int i = 0; i < 1000; i++)
+    dealloc(alloc(8));
+  st = allocstats();
+  TEST(__LINE__,
+       st.allocs == 1000 && st.frees == 1000 && st.request_hist[3] == 1000 &&
+           st.in_use > 0 && st.in_use % 16 == 0 && st.in_use <= 32 * 16,
+       1);
+  allocmt(0);
+  resetalloc();
+}
+
+void test_realloc() {
+  allocopt(FIRST_FIT, 0);
+  char *a = alloc(100);
+  char *b = alloc(100);
+  char *c = alloc(100);
+  memset(a, 'a', 100);
+  dealloc(b);
+
+  // a takes over the free chunk after it, then has to move past c
+  bool ok = realloc_block(a, 180) == a;
+  memset(a + 100, 'b', 80);
+  char *d = realloc_block(a, 1000);
+  ok = ok && d != NULL && d != a && d[0] == 'a' && d[99] == 'a' &&
+       d[100] == 'b' && d[179] == 'b';
+  TEST(__LINE__, ok, 2);
+
+  // d is at the top of the heap, which grows under it
+  void *brk = sbrk(0);
+  TEST(__LINE__, realloc_block(d, 4000) == d && sbrk(0) > brk && d[0] == 'a',
+       2);
+  dealloc(c);
+  dealloc(d);
+  TEST(__LINE__, allocinfo().free_chunks == 1, 1);
+
+  ok = alloc_aligned(10, 3) == NULL;
+  for (int align = 1; ok && align <= 4096; align *= 2) {
+    alloc(align % 7);
+    void *p = alloc_aligned(align % 5, align);
+    ok = p != NULL && (uintptr_t)p % align == 0;
+  }
+  allocparam(ALLOC_ALIGNMENT, 16);
+  for (int i = 1; ok && i < 50; i++) {
+    void *p = alloc(i);
+    ok = p != NULL && (uintptr_t)p % 16 == 0;
+  }
+  ok = ok && allocparam(ALLOC_ALIGNMENT, 24) == -1;
+  allocparam(ALLOC_ALIGNMENT, 1);
+  TEST(__LINE__, ok, 2);
+  resetalloc();
+}
+
+void test_trace_ring() {
+  allocopt(FIRST_FIT, 0);
+  void *a = alloc(32);
+  dealloc(a);
+
+  char path[] = "/tmp/alloc_ring_XXXXXX";
+  int fd = mkstemp(path);
+  int count = alloctrace_dump(fd);
+  char buf[64] = {0};
+  char want[64];
+  snprintf(want, 64, "a %lx 32\nf %lx\n", (unsigned long)(uintptr_t)a,
+           (unsigned long)(uintptr_t)a);
+  // The ring holds the newest calls, so the two above end the dump
+  off_t end = lseek(fd, 0, SEEK_END);
+  bool ok = fd >= 0 && end >= (off_t)strlen(want) &&
+            pread(fd, buf, strlen(want), end - strlen(want)) > 0 &&
+            strcmp(buf, want) == 0;
+  close(fd);
+  unlink(path);
+  TEST(__LINE__, ALLOC_TRACE_LEVEL == 0 ? count == 0 : count >= 2 && ok, 1);
+  resetalloc();
+}
+
+// Holes of 64, 128, ..., 512 bytes, freed in that order
+static void fit_holes(enum algs alg, void *p[8]) {
+  allocopt(alg, 0);
+  for (int i = 0; i < 8; i++) {
+    p[i] = alloc(64 * (i + 1));
+    alloc(8);
+  }
+  for (int i = 0; i < 8; i++)
+    dealloc(p[i]);
+}
+
+// Churn of random sizes with the current policy; true if the heap is left
+// as it was found, bar what it grew by
+static bool churn_restores(unsigned int seed) {
+  struct allocinfo info = allocinfo();
+  uint64_t heap_size = allocstats().heap_size;
+  bool ok = true;
+  void *q[SLOTS] = {NULL};
+  for (int i = 0; ok && i < 10000; i++) {
+    int s = rand_r(&seed) % SLOTS;
+    dealloc(q[s]);
+    q[s] = alloc(rand_r(&seed) % 2000);
+    ok = q[s] != NULL;
+  }
+  for (int s = 0; s < SLOTS; s++)
+    dealloc(q[s]);
+  return ok && allocinfo().free_chunks == info.free_chunks &&
+         allocinfo().free_size - info.free_size ==
+             allocstats().heap_size - heap_size;
+}
+
+void test_tlsf() {
+  void *p[8];
+  fit_holes(TLSF, p);
+
+  // Requests are rounded up to the next size range, so 100 bytes skips the
+  // 64-byte hole, which a 64-byte request gets
+  TEST(__LINE__, alloc(100) == p[1] && alloc(64) == p[0], 2);
+
+  TEST(__LINE__, churn_restores(5), 1);
+  resetalloc();
+}
+
+void test_arena_handles() {
+  allocopt(FIRST_FIT, 0);
+  void *m = alloc(100);
+  struct allocinfo info = allocinfo();
+
+  // Two arenas with their own policy, apart from each other and the heap
+  struct arena *a = arena_create(BEST_FIT, 0);
+  struct arena *b = arena_create(TLSF, 1 << 20);
+  bool ok = a != NULL && b != NULL;
+  void *p[SLOTS];
+  for (int i = 0; ok && i < SLOTS; i++) {
+    p[i] = arena_alloc(i % 2 ? a : b, 16 * (i + 1));
+    ok = p[i] != NULL;
+    if (ok)
+      memset(p[i], i, 16 * (i + 1));
+  }
+  for (int i = 0; ok && i < SLOTS; i += 2)
+    arena_free(b, p[i]);
+  for (int i = 1; ok && i < SLOTS; i += 2)
+    ok = ((unsigned char *)p[i])[16 * i] == i;
+  ok = ok && arena_info(b).free_size >= 16 * (SLOTS / 2) * (SLOTS / 2) &&
+       arena_alloc(b, 2 << 20) == NULL;
+  TEST(__LINE__,
+       ok && allocinfo().free_size == info.free_size &&
+           allocinfo().free_chunks == info.free_chunks,
+       2);
+
+  // A reset drops every block at once and the arena is usable again
+  arena_reset(a);
+  ok = a != NULL && arena_info(a).free_chunks == 0 &&
+       arena_info(a).free_size == 0;
+  void *q = ok ? arena_alloc(a, 64) : NULL;
+  ok = ok && q != NULL && arena_info(a).free_chunks == 1;
+  arena_free(a, q);
+  ok = ok && arena_info(a).free_chunks == 1;
+  if (a)
+    arena_destroy(a);
+  if (b)
+    arena_destroy(b);
+  dealloc(m);
+  TEST(__LINE__, ok && allocinfo().free_chunks == 1, 1);
+
+  // An arena keeps the settings it was made with: later deferred frees of
+  // the heap do not reach it, and its blocks still merge on every free
+  ok = arena_create((enum algs)(TLSF + 1), 0) == NULL;
+  a = arena_create(FIRST_FIT, 0);
+  allocparam(ALLOC_DEFER, 8);
+  p[0] = a ? arena_alloc(a, 32) : NULL;
+  p[1] = a ? arena_alloc(a, 32) : NULL;
+  ok = ok && p[0] && p[1];
+  if (ok) {
+    arena_free(a, p[0]);
+    arena_free(a, p[1]);
+    ok = arena_info(a).free_chunks == 1 && arena_info(a).free_size >= 64;
+  }
+  if (a)
+    arena_destroy(a);
+  allocparam(ALLOC_DEFER, 0);
+  TEST(__LINE__, ok, 1);
+  resetalloc();
+}
+
+void test_region() {
+  struct region *r = region_create();
+  bool ok = r != NULL;
+  char *a = ok ? region_alloc(r, 10) : NULL;
+  char *b = ok ? region_alloc(r, 1) : NULL;
+  // Blocks follow each other, aligned for any type
+  ok = ok && a && b && b - a == 16 && (uintptr_t)a % 16 == 0;
+
+  // Blocks past the mark go away, the ones before it stay
+  struct region_mark m = ok ? region_mark(r) : (struct region_mark){0};
+  for (int round = 0; ok && round < 4; round++) {
+    char *first = region_alloc(r, 100);
+    ok = first == b + 16;
+    for (int i = 0; ok && i < 100; i++) {
+      char *p = region_alloc(r, 1000 * (i % 3) + 50);
+      ok = p != NULL;
+      if (ok)
+        memset(p, i, 50);
+    }
+    if (ok)
+      region_release_to(r, m);
+  }
+  TEST(__LINE__, ok, 2);
+
+  // A block bigger than a chunk gets a chunk of its own
+  char *big = ok ? region_alloc(r, 1 << 20) : NULL;
+  ok = ok && big != NULL;
+  if (ok) {
+    memset(big, 1, 1 << 20);
+    region_release_to(r, m);
+    ok = region_alloc(r, 8) == b + 16;
+  }
+  region_destroy(r);
+  TEST(__LINE__, ok, 1);
+}
+
+// Splits and merges of a steady churn of small blocks
+static uint64_t churn_work(void) {
+  struct allocstats before = allocstats();
+  void *q[SLOTS] = {NULL};
+  unsigned int seed = 9;
+  for (int i = 0; i < 20000; i++) {
+    int s = rand_r(&seed) % SLOTS;
+    dealloc(q[s]);
+    q[s] = alloc(16 * (1 + s % 8));
+  }
+  for (int s = 0; s < SLOTS; s++)
+    dealloc(q[s]);
+  struct allocstats after = allocstats();
+  return after.splits - before.splits + after.merges - before.merges;
+}
+
+void test_defer() {
+  allocopt(FIRST_FIT, 0);
+  uint64_t eager = churn_work();
+  resetalloc();
+  allocparam(ALLOC_DEFER, 64);
+  allocopt(FIRST_FIT, 0);
+  uint64_t deferred = churn_work();
+  TEST(__LINE__, deferred * 4 < eager, 2);
+
+  // Waiting blocks are merged when nothing else fits, not grown past
+  void *p[16];
+  for (int i = 0; i < 16; i++)
+    p[i] = alloc(100);
+  uint64_t heap_size = allocstats().heap_size;
+  struct allocinfo info = allocinfo();
+  for (int i = 0; i < 16; i++)
+    dealloc(p[i]);
+  bool ok = allocinfo().free_chunks == info.free_chunks &&
+            allocinfo().largest_free_chunk_size ==
+                info.largest_free_chunk_size;
+  void *big = alloc(info.largest_free_chunk_size + 1000);
+  ok = ok && big != NULL && allocstats().heap_size == heap_size &&
+       allocstats().in_use == info.largest_free_chunk_size + 1000;
+  allocparam(ALLOC_DEFER, 0);
+  TEST(__LINE__, ok, 1);
+  resetalloc();
+}
+
+void test_compact() {
+  allocopt(WORST_FIT, 0);
+  // Every other handle block freed leaves holes too small for big
+  void **h[SLOTS];
+  for (int i = 0; i < SLOTS; i++) {
+    h[i] = alloc_handle(200);
+    if (h[i])
+      memset(*h[i], i, 200);
+  }
+  void *pinned = alloc(50);
+  for (int i = 0; i < SLOTS; i += 2)
+    dealloc_handle(h[i]);
+  struct allocinfo before = allocinfo();
+  uint64_t heap_size = allocstats().heap_size;
+
+  int moved = alloccompact();
+  struct allocinfo after = allocinfo();
+  bool ok = moved == SLOTS / 2 && after.free_chunks < before.free_chunks &&
+            after.largest_free_chunk_size >= SLOTS / 2 * 200;
+  for (int i = 1; ok && i < SLOTS; i += 2) {
+    unsigned char *p = *h[i];
+    ok = p[0] == i && p[199] == i && (i == 1 || p > (unsigned char *)*h[i - 2]);
+  }
+  TEST(__LINE__, ok, 2);
+
+  // The gathered space serves a big block without growing the heap
+  void *big = alloc(SLOTS / 2 * 200);
+  ok = big != NULL && allocstats().heap_size == heap_size;
+  for (int i = 1; i < SLOTS; i += 2)
+    dealloc_handle(h[i]);
+  dealloc(big);
+  dealloc(pinned);
+  TEST(__LINE__, ok && allocinfo().free_chunks == 1, 1);
+  resetalloc();
+}
+
+void test_trim() {
+  allocparam(ALLOC_TRIM_THRESHOLD, 128 * 1024);
+  allocopt(FIRST_FIT, 0);
+  void *small = alloc(100);
+  uint64_t heap_size = allocstats().heap_size;
+  void *big = alloc(1 << 20);
+  memset(big, 1, 1 << 20);
+  dealloc(big);
+  // The top is cut back to less than a page past the small block
+  struct allocstats st = allocstats();
+  TEST(__LINE__,
+       st.trims == 1 && st.heap_size <= heap_size &&
+           st.heap_size < 100 + 3 * HEADER_SIZE + 4096 &&
+           sbrk(0) == (char *)small - HEADER_SIZE + st.heap_size,
+       2);
+  dealloc(small);
+
+  // In segments the pages stay mapped, so the heap does not shrink
+  allocparam(ALLOC_ARENAS, 1);
+  allocopt(BEST_FIT, 0);
+  big = alloc(1 << 20);
+  memset(big, 1, 1 << 20);
+  heap_size = allocstats().heap_size;
+  dealloc(big);
+  big = alloc(1 << 20);
+  bool ok = allocstats().trims == 1 && allocstats().heap_size == heap_size &&
+            big != NULL && ((char *)big)[1 << 19] == 0;
+  dealloc(big);
+  allocparam(ALLOC_ARENAS, 0);
+  allocparam(ALLOC_TRIM_THRESHOLD, 0);
+  TEST(__LINE__, ok, 1);
+  resetalloc();
+}
+
+// Runs f in a child with stderr closed, true if the child aborted
+static bool aborts(void (*f)(void)) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(STDERR_FILENO);
+    f();
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+static void double_free(void) {
+  void *p = alloc(40);
+  alloc(8);
+  dealloc(p);
+  dealloc(p);
+}
+
+static void overflow(void) {
+  char *p = alloc(40);
+  p[40] = 1;
+  dealloc(p);
+}
+
+static void clean(void) {
+  char *p = alloc(40);
+  memset(p, 1, 40);
+  p = realloc_block(p, 4000);
+  memset(p, 1, 4000);
+  dealloc(p);
+}
+
+void test_checked() {
+  allocparam(ALLOC_CHECKED, 1);
+  allocopt(BEST_FIT, 0);
+  TEST(__LINE__, aborts(double_free) && aborts(overflow) && !aborts(clean),
+       2);
+
+  // heap_verify() finds writes past a block that is not freed yet
+  void *p[SLOTS];
+  for (int i = 0; i < SLOTS; i++)
+    p[i] = alloc(i * 3);
+  for (int i = 0; i < SLOTS; i += 3)
+    dealloc(p[i]);
+  bool ok = heap_verify() == 0;
+  ((char *)p[10])[30] = 0;
+  int saved = dup(STDERR_FILENO);
+  close(STDERR_FILENO);
+  ok = ok && heap_verify() == -1;
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+  ((char *)p[10])[30] = (char)0xAB;
+  TEST(__LINE__, ok && heap_verify() == 0, 1);
+
+  // A broken free list link is caught as well
+  struct header *chunk = (struct header *)p[0] - 1;
+  struct header *next = chunk->next;
+  chunk->next = chunk;
+  saved = dup(STDERR_FILENO);
+  close(STDERR_FILENO);
+  ok = heap_verify() == -1;
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+  chunk->next = next;
+  allocparam(ALLOC_CHECKED, 0);
+  TEST(__LINE__, ok && heap_verify() == 0, 1);
+  resetalloc();
+}
+
+void test_linear() {
+  allocparam(ALLOC_LINEAR, 1);
+  void *p[8];
+  // The whole list is scanned for the closest fit, while first fit takes
+  // the newest chunk that is big enough
+  fit_holes(BEST_FIT, p);
+  bool ok = alloc(100) == p[1] && alloc(64) == p[0];
+  fit_holes(FIRST_FIT, p);
+  ok = ok && alloc(100) == p[7];
+  TEST(__LINE__, ok, 2);
+
+  fit_holes(WORST_FIT, p);
+  TEST(__LINE__, churn_restores(9), 1);
+  allocparam(ALLOC_LINEAR, 0);
+  resetalloc();
+}
+
+void test_dense() {
+  allocparam(ALLOC_DENSE, 1);
+  void *p[8];
+  // The same picks as the list makes, newest first for first fit
+  fit_holes(BEST_FIT, p);
+  bool ok = alloc(100) == p[1] && alloc(64) == p[0];
+  fit_holes(WORST_FIT, p);
+  ok = ok && alloc(100) == p[7] && alloc(300) == p[6];
+  fit_holes(FIRST_FIT, p);
+  ok = ok && alloc(100) == p[7];
+  TEST(__LINE__, ok, 2);
+
+  // Taking chunks out of the middle of the array keeps it consistent
+  fit_holes(BEST_FIT, p);
+  void *q[SLOTS] = {NULL};
+  unsigned int seed = 11;
+  for (int i = 0; ok && i < 10000; i++) {
+    int s = rand_r(&seed) % SLOTS;
+    dealloc(q[s]);
+    q[s] = alloc(rand_r(&seed) % 2000);
+    ok = q[s] != NULL && (i % 100 != 0 || heap_verify() == 0);
+  }
+  for (int s = 0; s < SLOTS; s++)
+    dealloc(q[s]);
+  TEST(__LINE__, ok && heap_verify() == 0, 1);
+
+  // The array grows past its first slots, and best fit still finds one of
+  // the holes of the exact size among them
+  static void *r[1200];
+  allocopt(BEST_FIT, 0);
+  for (int i = 0; i < 1200; i++)
+    r[i] = alloc(32 + i % 7 * 16);
+  for (int i = 0; i < 1200; i += 2)
+    dealloc(r[i]);
+  ok = heap_verify() == 0 && allocinfo().free_chunks >= 600;
+  void *b = alloc(32);
+  bool hole = false;
+  for (int i = 0; i < 1200; i += 14)
+    hole = hole || b == r[i];
+  TEST(__LINE__, ok && hole && heap_verify() == 0, 1);
+  allocparam(ALLOC_DENSE, 0);
+  resetalloc();
+}
+
+int main() {
+  test_threads();
+  test_arenas();
+  test_pool();
+  test_stats();
+  test_realloc();
+  test_trace_ring();
+  test_tlsf();
+  test_arena_handles();
+  test_region();
+  test_defer();
+  test_compact();
+  test_trim();
+  test_checked();
+  test_linear();
+  test_dense();
+  return 0;
+}
@@ -0,0 +1,112 @@
+#define _DEFAULT_SOURCE
+#include "pool.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_MIN_BLOCKS 8 // slabs for big blocks still hold this many
+
+// Each slab starts with this header; the first one also holds the pool
+struct slab {
+  struct slab *next;
+  size_t size; // whole mapping
+};
+
+struct pool {
+  size_t block_size; // rounded up to the alignment
+  size_t align;
+  void *free;        // free blocks, linked through their first word
+  char *bump;        // next never-used block of the newest slab
+  char *end;         // end of the newest slab
+  struct slab *slabs;
+};
+
+static size_t align_up(size_t n, size_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+// Maps a slab with room for at least SLAB_MIN_BLOCKS blocks past head bytes
+static struct slab *slab_map(size_t head, size_t block_size, size_t align) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = align_up(head + align + block_size * SLAB_MIN_BLOCKS, page);
+  if (size < SLAB_SIZE)
+    size = SLAB_SIZE;
+  struct slab *slab = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (slab == MAP_FAILED) {
+    perror("mmap failed");
+    return NULL;
+  }
+  slab->size = size;
+  slab->next = NULL;
+  return slab;
+}
+
+// Makes the blocks of slab, past its first head bytes, the ones to bump
+static void slab_use(struct pool *pool, struct slab *slab, size_t head) {
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pool->bump = (char *)align_up((uintptr_t)slab + head, pool->align);
+  pool->end = (char *)slab + slab->size;
+}
+
+struct pool *pool_create(size_t size, size_t align) {
+  if (align == 0)
+    align = sizeof(void *);
+  if (align & (align - 1))
+    return NULL;
+  size_t block_size = align_up(size < sizeof(void *) ? sizeof(void *) : size,
+                               align);
+
+  size_t head = sizeof(struct slab) + sizeof(struct pool);
+  struct slab *slab = slab_map(head, block_size, align);
+  if (!slab)
+    return NULL;
+  struct pool *pool = (struct pool *)(slab + 1);
+  pool->block_size = block_size;
+  pool->align = align;
+  pool->free = NULL;
+  pool->slabs = NULL;
+  slab_use(pool, slab, head);
+  return pool;
+}
+
+void *pool_alloc(struct pool *pool) {
+  void *block = pool->free;
+  if (block) {
+    pool->free = *(void **)block;
+    return block;
+  }
+  // Slabs are carved lazily, so their pages are only touched when used
+  if (pool->bump + pool->block_size > pool->end) {
+    struct slab *slab = slab_map(sizeof(struct slab), pool->block_size,
+                                 pool->align);
+    if (!slab)
+      return NULL;
+    slab_use(pool, slab, sizeof(struct slab));
+  }
+  block = pool->bump;
+  pool->bump += pool->block_size;
+  return block;
+}
+
+void pool_free(struct pool *pool, void *block) {
+  if (!block)
+    return;
+  *(void **)block = pool->free;
+  pool->free = block;
+}
+
+void pool_destroy(struct pool *pool) {
+  if (!pool)
+    return;
+  // The pool lives in the oldest slab, which is last in the list
+  struct slab *slab = pool->slabs;
+  while (slab) {
+    struct slab *next = slab->next;
+    munmap(slab, slab->size);
+    slab = next;
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * A pool hands out blocks of one fixed size. Blocks are carved from slabs
+ * mapped on demand and have no header: a free block holds the link to the
+ * next free one, so pool_alloc() and pool_free() are a few instructions.
+ * A pool is not thread-safe; give each thread its own.
+ */
+struct pool;
+
+/*
+ * pool_create() makes a pool of blocks of the first argument's size. The
+ * second argument is their alignment, a power of two; 0 means pointer
+ * alignment. It returns NULL if the slab cannot be mapped.
+ */
+struct pool *pool_create(size_t, size_t);
+
+/*
+ * pool_alloc() returns a block from the pool, or NULL if it cannot grow.
+ */
+void *pool_alloc(struct pool *);
+
+/*
+ * pool_free() gives a block back to the pool it came from.
+ */
+void pool_free(struct pool *, void *);
+
+/*
+ * pool_destroy() unmaps every slab of the pool, so all its blocks at once.
+ */
+void pool_destroy(struct pool *);
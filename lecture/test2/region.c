@@ -0,0 +1,114 @@
+#define _DEFAULT_SOURCE
+#include "region.h"
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define ALIGN alignof(max_align_t)
+
+// Each chunk starts with this header; the first one also holds the region
+struct chunk {
+  struct chunk *next; // the chunk before, toward the first one
+  size_t size;        // whole mapping
+};
+
+struct region {
+  char *bump;           // next free byte of the newest chunk
+  char *end;            // end of the newest chunk
+  struct chunk *chunks; // newest first
+  struct chunk *spare;  // last chunk released, kept for reuse
+};
+
+static size_t align_up(size_t n, size_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+// Maps a chunk with room for size bytes past head bytes
+static struct chunk *chunk_map(size_t head, size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t len = align_up(align_up(head, ALIGN) + size, page);
+  if (len < CHUNK_SIZE)
+    len = CHUNK_SIZE;
+  struct chunk *chunk = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (chunk == MAP_FAILED) {
+    perror("mmap failed");
+    return NULL;
+  }
+  chunk->size = len;
+  chunk->next = NULL;
+  return chunk;
+}
+
+// Makes chunk, past its first head bytes, the one to bump
+static void chunk_use(struct region *region, struct chunk *chunk,
+                      size_t head) {
+  chunk->next = region->chunks;
+  region->chunks = chunk;
+  region->bump = (char *)chunk + align_up(head, ALIGN);
+  region->end = (char *)chunk + chunk->size;
+}
+
+struct region *region_create(void) {
+  size_t head = sizeof(struct chunk) + sizeof(struct region);
+  struct chunk *chunk = chunk_map(head, 0);
+  if (!chunk)
+    return NULL;
+  struct region *region = (struct region *)(chunk + 1);
+  region->chunks = NULL;
+  region->spare = NULL;
+  chunk_use(region, chunk, head);
+  return region;
+}
+
+void *region_alloc(struct region *region, size_t size) {
+  size = align_up(size ? size : 1, ALIGN);
+  if (size > (size_t)(region->end - region->bump)) {
+    // The rest of the newest chunk is left unused
+    struct chunk *chunk = region->spare;
+    if (chunk && chunk->size - align_up(sizeof(struct chunk), ALIGN) >= size)
+      region->spare = NULL;
+    else if ((chunk = chunk_map(sizeof(struct chunk), size)) == NULL)
+      return NULL;
+    chunk_use(region, chunk, sizeof(struct chunk));
+  }
+  void *block = region->bump;
+  region->bump += size;
+  return block;
+}
+
+struct region_mark region_mark(struct region *region) {
+  return (struct region_mark){region->chunks, region->bump};
+}
+
+void region_release_to(struct region *region, struct region_mark mark) {
+  while (region->chunks != mark.chunk) {
+    struct chunk *chunk = region->chunks;
+    region->chunks = chunk->next;
+    // Keeping one chunk stops a loop that crosses a chunk boundary from
+    // mapping and unmapping it every time around
+    if (region->spare == NULL && chunk->size == CHUNK_SIZE)
+      region->spare = chunk;
+    else
+      munmap(chunk, chunk->size);
+  }
+  region->bump = mark.bump;
+  region->end = (char *)region->chunks + region->chunks->size;
+}
+
+void region_destroy(struct region *region) {
+  if (!region)
+    return;
+  if (region->spare)
+    munmap(region->spare, region->spare->size);
+  // The region lives in the first chunk, which is last in the list
+  struct chunk *chunk = region->chunks;
+  while (chunk) {
+    struct chunk *next = chunk->next;
+    munmap(chunk, chunk->size);
+    chunk = next;
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * A region hands out blocks by bumping a pointer through chunks mapped on
+ * demand; blocks have no header and are never freed one by one. Instead,
+ * region_mark() notes how far the region got and region_release_to() frees
+ * every block allocated since, so a region suits memory that lives for one
+ * request or one task. A region is not thread-safe; give each thread its
+ * own.
+ */
+struct region;
+
+/*
+ * Where a region was at region_mark(). Only valid for the region it came
+ * from, and only until that region is released to an earlier mark.
+ */
+struct region_mark {
+  void *chunk;
+  char *bump;
+};
+
+/*
+ * region_create() makes an empty region. It returns NULL if the first chunk
+ * cannot be mapped.
+ */
+struct region *region_create(void);
+
+/*
+ * region_alloc() returns a block of the argument's size, aligned for any
+ * type, or NULL if the region cannot grow.
+ */
+void *region_alloc(struct region *, size_t);
+
+/*
+ * region_mark() returns the current end of the region.
+ */
+struct region_mark region_mark(struct region *);
+
+/*
+ * region_release_to() frees every block allocated since the mark was taken
+ * and unmaps the chunks mapped since, keeping one for the next allocations.
+ */
+void region_release_to(struct region *, struct region_mark);
+
+/*
+ * region_destroy() unmaps every chunk of the region, so all its blocks at
+ * once.
+ */
+void region_destroy(struct region *);
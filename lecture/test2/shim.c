@@ -0,0 +1,144 @@
+#define _DEFAULT_SOURCE
+#include "alloc.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <unistd.h>
+
+// malloc() and friends on top of alloc(), to run unmodified programs on
+// the allocator:
+//   LD_PRELOAD=./libshim.so program
+// ALLOC_POLICY picks the algorithm: first, best, worst or tlsf (default
+// first). With ALLOC_STATS set, allocstats() is written to stderr at exit.
+
+static bool ready = false;
+
+// The heap grows by segments, as the program or its libraries may move the
+// break themselves, and payloads get malloc()'s alignment
+static void shim_init(void) {
+  if (ready)
+    return;
+  ready = true;
+  static const char *names[] = {"first", "best", "worst", "tlsf"};
+  const char *policy = getenv("ALLOC_POLICY");
+  enum algs algs = FIRST_FIT;
+  for (int i = 0; policy && i <= TLSF; i++) {
+    if (strcmp(policy, names[i]) == 0)
+      algs = i;
+  }
+  allocparam(ALLOC_ARENAS, 1);
+  allocparam(ALLOC_ALIGNMENT, 16);
+  allocopt(algs, 0);
+  allocmt(1);
+}
+
+__attribute__((constructor)) static void shim_start(void) { shim_init(); }
+
+// No stdio here: it may allocate, and the program's streams may be gone
+__attribute__((destructor)) static void shim_stats(void) {
+  if (!getenv("ALLOC_STATS"))
+    return;
+  struct allocstats st = allocstats();
+  char buf[512];
+  int len = snprintf(
+      buf, sizeof(buf),
+      "alloc: %lu allocs, %lu frees, %lu failed\n"
+      "alloc: in use %lu (peak %lu), heap %lu (peak %lu)\n"
+      "alloc: %lu splits, %lu merges, %lu grows, %lu trims\n"
+      "alloc: fragmentation %.3f\n",
+      st.allocs, st.frees, st.failed, st.in_use, st.peak_in_use,
+      st.heap_size, st.peak_heap_size, st.splits, st.merges, st.grows,
+      st.trims, st.fragmentation);
+  write(STDERR_FILENO, buf, len);
+}
+
+// alloc() takes an int
+static bool too_big(size_t size) {
+  if (size <= INT32_MAX)
+    return false;
+  errno = ENOMEM;
+  return true;
+}
+
+void *malloc(size_t size) {
+  shim_init();
+  if (too_big(size))
+    return NULL;
+  void *p = alloc(size);
+  if (!p)
+    errno = ENOMEM;
+  return p;
+}
+
+void free(void *ptr) { dealloc(ptr); }
+
+void *calloc(size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  void *p = malloc(count * size);
+  if (p)
+    memset(p, 0, count * size);
+  return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+  shim_init();
+  if (ptr && size == 0) {
+    dealloc(ptr);
+    return NULL;
+  }
+  if (too_big(size))
+    return NULL;
+  void *p = realloc_block(ptr, size);
+  if (!p)
+    errno = ENOMEM;
+  return p;
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size) {
+  shim_init();
+  if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0 ||
+      align > INT32_MAX)
+    return EINVAL;
+  if (too_big(size))
+    return ENOMEM;
+  void *p = alloc_aligned(size, align);
+  if (!p)
+    return ENOMEM;
+  *ptr = p;
+  return 0;
+}
+
+// The other aligned allocators, so no block comes from the system malloc
+void *aligned_alloc(size_t align, size_t size) {
+  void *p = NULL;
+  int err = posix_memalign(&p, align < sizeof(void *) ? sizeof(void *) : align,
+                           size);
+  if (err)
+    errno = err;
+  return p;
+}
+
+void *memalign(size_t align, size_t size) { return aligned_alloc(align, size); }
+
+void *valloc(size_t size) {
+  return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+// Whole pages, at least one
+void *pvalloc(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (size > SIZE_MAX - page) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return valloc(size ? (size + page - 1) / page * page : page);
+}
+
+size_t malloc_usable_size(void *ptr) { return alloc_usable(ptr); }
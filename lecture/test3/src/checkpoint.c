@@ -0,0 +1,162 @@
+#include "checkpoint.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CKPT_MAGIC 0x6b63726dU // "mrck"
+#define MANIFEST "manifest"
+
+struct ckpt_header {
+  uint32_t magic;
+  uint64_t count;
+};
+
+// -----------------------------
+// HELPERS
+// -----------------------------
+static uint64_t fnv1a(uint64_t h, const char *s, size_t max) {
+  for (size_t i = 0; i < max && s[i] != '\0'; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  // Separator, so "ab","c" and "a","bc" hash differently
+  h ^= 0xff;
+  h *= 1099511628211ULL;
+  return h;
+}
+
+static uint64_t input_id(const struct mr_input *input) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < input->count; i++) {
+    h = fnv1a(h, input->kv_lst[i].key, MAX_KEY_SIZE);
+    h = fnv1a(h, input->kv_lst[i].value, MAX_VALUE_SIZE);
+  }
+  return h ^ input->count;
+}
+
+// Removes the files in dir whose name starts with prefix
+static void remove_files(const char *dir, const char *prefix) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+  struct dirent *ent;
+  char path[PATH_MAX];
+  while ((ent = readdir(d)) != NULL) {
+    if (strncmp(ent->d_name, prefix, strlen(prefix)) == 0) {
+      snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+      unlink(path);
+    }
+  }
+  closedir(d);
+}
+
+// Writes len bytes to dir/name through a temporary file and a rename
+static int write_atomic(const char *dir, const char *name, const void *head,
+                        size_t head_len, const void *data, size_t len) {
+  char tmp[PATH_MAX];
+  char path[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s/tmp-%s", dir, name);
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+  FILE *f = fopen(tmp, "wb");
+  if (!f)
+    return -1;
+  int ok = fwrite(head, 1, head_len, f) == head_len &&
+           (len == 0 || fwrite(data, 1, len, f) == len) && fflush(f) == 0 &&
+           fsync(fileno(f)) == 0;
+  if (fclose(f) != 0)
+    ok = 0;
+  if (!ok || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+// -----------------------------
+// JOB MANIFEST
+// -----------------------------
+int ckpt_begin(const char *dir, const struct mr_input *input,
+               size_t reducer_count) {
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    return -1;
+  remove_files(dir, "tmp-");
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, MANIFEST);
+  unsigned long long old_id = 0;
+  size_t old_reducers = 0;
+  int found = 0;
+  FILE *f = fopen(path, "r");
+  if (f) {
+    found = fscanf(f, "%llx %zu", &old_id, &old_reducers) == 2;
+    fclose(f);
+  }
+
+  // Map splits only depend on the input, reduce partitions also depend on
+  // the number of reducers
+  uint64_t id = input_id(input);
+  if (!found || old_id != id) {
+    remove_files(dir, "map-");
+    remove_files(dir, "reduce-");
+  } else if (old_reducers != reducer_count) {
+    remove_files(dir, "reduce-");
+  }
+
+  char manifest[64];
+  int len = snprintf(manifest, sizeof(manifest), "%llx %zu\n",
+                     (unsigned long long)id, reducer_count);
+  return write_atomic(dir, MANIFEST, manifest, len, NULL, 0);
+}
+
+void ckpt_end(const char *dir) {
+  remove_files(dir, "map-");
+  remove_files(dir, "reduce-");
+  remove_files(dir, "tmp-");
+  remove_files(dir, MANIFEST);
+}
+
+// -----------------------------
+// SPLITS AND PARTITIONS
+// -----------------------------
+int ckpt_save(const char *dir, const char *kind, size_t index,
+              const struct kv_buf *buf) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s-%zu", kind, index);
+  struct ckpt_header head = {CKPT_MAGIC, buf->count};
+  return write_atomic(dir, name, &head, sizeof(head), buf->kv_lst,
+                      sizeof(struct mr_in_kv) * buf->count);
+}
+
+int ckpt_load(const char *dir, const char *kind, size_t index,
+              struct kv_buf *buf) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s-%zu", dir, kind, index);
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return -1;
+
+  struct ckpt_header head;
+  if (fread(&head, sizeof(head), 1, f) != 1 || head.magic != CKPT_MAGIC) {
+    fclose(f);
+    return -1;
+  }
+  buf->kv_lst = malloc(sizeof(struct mr_in_kv) * (head.count + 1));
+  if (!buf->kv_lst ||
+      fread(buf->kv_lst, sizeof(struct mr_in_kv), head.count, f) !=
+          head.count) {
+    fclose(f);
+    kv_buf_free(buf);
+    return -1;
+  }
+  fclose(f);
+  buf->count = head.count;
+  buf->cap = head.count + 1;
+  return 0;
+}
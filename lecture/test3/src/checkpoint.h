@@ -0,0 +1,29 @@
+#pragma once
+
+#include "interface.h"
+#include "radix.h"
+#include <stddef.h>
+
+// Input records per map split; a split is the unit of a map checkpoint
+#define MR_SPLIT_SIZE 64
+
+// Prepares dir for a job over input with reducer_count reducers
+// Keeps the checkpoints left by an earlier run of the same job and drops
+// the ones that belong to a different job
+// Returns 0 on success, -1 on failure
+int ckpt_begin(const char *dir, const struct mr_input *input,
+               size_t reducer_count);
+
+// Writes the records of buf as checkpoint kind ("map" or "reduce") index
+// The file appears atomically, so a crash never leaves half a checkpoint
+// Returns 0 on success, -1 on failure
+int ckpt_save(const char *dir, const char *kind, size_t index,
+              const struct kv_buf *buf);
+
+// Reads checkpoint kind index into the empty buffer buf
+// Returns 0 if the checkpoint was found, -1 otherwise
+int ckpt_load(const char *dir, const char *kind, size_t index,
+              struct kv_buf *buf);
+
+// Removes the checkpoints of a finished job
+void ckpt_end(const char *dir);
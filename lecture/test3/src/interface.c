@@ -1,5 +1,7 @@
 ///*
 #include "interface.h"
+#include "checkpoint.h"
+#include "radix.h"
 #include "uthash.h"
 #include <pthread.h>
 #include <stdio.h>
@@ -28,6 +30,71 @@ struct final_kv {
 static struct final_kv *final_table = NULL;
 pthread_mutex_t final_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// -----------------------------
+// SHUFFLE OPTIONS
+// -----------------------------
+static enum mr_shuffle shuffle = MR_SHUFFLE_HASH;
+
+// Per-thread record buffer; when set, emits are appended here instead of
+// going through the shared tables
+static __thread struct kv_buf *emit_buf = NULL;
+
+enum mr_shuffle mr_shuffleopt(enum mr_shuffle opt) {
+  enum mr_shuffle old = shuffle;
+  shuffle = opt;
+  return old;
+}
+
+// -----------------------------
+// CHECKPOINT OPTIONS
+// -----------------------------
+static char *ckpt_dir = NULL;
+
+int mr_checkpointopt(const char *dir) {
+  char *copy = NULL;
+  if (dir && !(copy = strdup(dir)))
+    return -1;
+  free(ckpt_dir);
+  ckpt_dir = copy;
+  return 0;
+}
+
+// -----------------------------
+// VALUE ORDER
+// -----------------------------
+static int (*value_cmp)(const char *, const char *) = NULL;
+
+void mr_sortopt(int (*cmp)(const char *, const char *)) { value_cmp = cmp; }
+
+// Stable bottom-up merge sort of values[0..count) by value_cmp
+// tmp must hold count values
+static void sort_values(char (*values)[MAX_VALUE_SIZE],
+                        char (*tmp)[MAX_VALUE_SIZE], size_t count) {
+  char(*src)[MAX_VALUE_SIZE] = values;
+  char(*dst)[MAX_VALUE_SIZE] = tmp;
+  for (size_t width = 1; width < count; width *= 2) {
+    for (size_t lo = 0; lo < count; lo += 2 * width) {
+      size_t mid = lo + width < count ? lo + width : count;
+      size_t hi = lo + 2 * width < count ? lo + 2 * width : count;
+      size_t a = lo, b = mid, k = lo;
+      while (a < mid && b < hi) {
+        if (value_cmp(src[b], src[a]) < 0)
+          memcpy(dst[k++], src[b++], MAX_VALUE_SIZE);
+        else
+          memcpy(dst[k++], src[a++], MAX_VALUE_SIZE);
+      }
+      memcpy(dst[k], src[a], (size_t)MAX_VALUE_SIZE * (mid - a));
+      k += mid - a;
+      memcpy(dst[k], src[b], (size_t)MAX_VALUE_SIZE * (hi - b));
+    }
+    char(*swap)[MAX_VALUE_SIZE] = src;
+    src = dst;
+    dst = swap;
+  }
+  if (src != values)
+    memcpy(values, src, (size_t)MAX_VALUE_SIZE * count);
+}
+
 // -----------------------------
 // HELPER: INIT
 // -----------------------------
@@ -75,6 +142,8 @@ static struct mr_out_kv *find_or_create_intermediate(const char *key) {
 // EMIT FUNCTIONS
 // -----------------------------
 int mr_emit_i(const char *key, const char *value) {
+  if (emit_buf)
+    return kv_buf_push(emit_buf, key, value);
   pthread_mutex_lock(&intermediate_mutex);
   struct mr_out_kv *kv = find_or_create_intermediate(key);
   if (!kv) {
@@ -88,6 +157,8 @@ int mr_emit_i(const char *key, const char *value) {
 }
 
 int mr_emit_f(const char *key, const char *value) {
+  if (emit_buf)
+    return kv_buf_push(emit_buf, key, value);
   pthread_mutex_lock(&final_mutex);
   struct final_kv *entry = NULL;
   HASH_FIND_STR(final_table, key, entry);
@@ -108,16 +179,34 @@ int mr_emit_f(const char *key, const char *value) {
 // THREAD ARGUMENTS
 // -----------------------------
 struct map_args {
-  const struct mr_in_kv *input;
+  const struct mr_input *parts; // input partitions, mapped as one sequence
+  size_t part_count;
   size_t start;
   size_t end;
   void (*map)(const struct mr_in_kv *);
+  struct kv_buf *buf; // emit target, NULL for the shared tables
 };
 
 struct reduce_args {
+  const struct mr_out_kv *groups;
   size_t start;
   size_t end;
   void (*reduce)(const struct mr_out_kv *);
+  struct kv_buf *buf; // emit target, NULL for the shared tables
+  const char *dir;    // checkpoint directory, NULL for none
+  size_t partition;   // checkpoint index of this reducer's groups
+  int status;
+};
+
+// Map thread over whole splits when checkpointing
+struct split_args {
+  const struct mr_input *input;
+  const char *dir;
+  size_t start; // first split
+  size_t end;   // one past the last split
+  void (*map)(const struct mr_in_kv *);
+  struct kv_buf *bufs; // one per split
+  int status;
 };
 
 // -----------------------------
@@ -125,17 +214,73 @@ struct reduce_args {
 // -----------------------------
 void *map_thread(void *arg) {
   struct map_args *args = arg;
-  for (size_t i = args->start; i < args->end; i++) {
-    args->map(&args->input[i]);
+  size_t base = 0; // index of the partition's first pair in the sequence
+  emit_buf = args->buf;
+  for (size_t p = 0; p < args->part_count && base < args->end; p++) {
+    const struct mr_input *part = &args->parts[p];
+    size_t start = args->start > base ? args->start - base : 0;
+    size_t end = args->end - base < part->count ? args->end - base : part->count;
+    for (size_t i = start; i < end; i++) {
+      args->map(&part->kv_lst[i]);
+    }
+    base += part->count;
+  }
+  emit_buf = NULL;
+  return NULL;
+}
+
+void *split_thread(void *arg) {
+  struct split_args *args = arg;
+  for (size_t s = args->start; s < args->end; s++) {
+    struct kv_buf *buf = &args->bufs[s];
+    // A split saved by an earlier run is not mapped again
+    if (ckpt_load(args->dir, "map", s, buf) == 0)
+      continue;
+
+    size_t end = (s + 1) * MR_SPLIT_SIZE;
+    if (end > args->input->count)
+      end = args->input->count;
+    emit_buf = buf;
+    for (size_t i = s * MR_SPLIT_SIZE; i < end; i++) {
+      args->map(&args->input->kv_lst[i]);
+    }
+    emit_buf = NULL;
+    if (ckpt_save(args->dir, "map", s, buf) != 0)
+      args->status = -1;
   }
   return NULL;
 }
 
 void *reduce_thread(void *arg) {
   struct reduce_args *args = arg;
+  char(*tmp)[MAX_VALUE_SIZE] = NULL;
+  size_t tmp_count = 0;
+
+  // A partition sealed by an earlier run is not reduced again
+  if (args->dir &&
+      ckpt_load(args->dir, "reduce", args->partition, args->buf) == 0)
+    return NULL;
+
+  emit_buf = args->buf;
   for (size_t i = args->start; i < args->end; i++) {
-    args->reduce(&intermediate[i]);
+    const struct mr_out_kv *group = &args->groups[i];
+    // Each reducer orders its own groups, so the sort runs in parallel
+    if (value_cmp && group->count > 1) {
+      if (tmp_count < group->count) {
+        free(tmp);
+        tmp = malloc(sizeof(char[MAX_VALUE_SIZE]) * group->count);
+        tmp_count = tmp ? group->count : 0;
+      }
+      if (tmp)
+        sort_values(group->value, tmp, group->count);
+    }
+    args->reduce(group);
   }
+  emit_buf = NULL;
+  free(tmp);
+  if (args->dir &&
+      ckpt_save(args->dir, "reduce", args->partition, args->buf) != 0)
+    args->status = -1;
   return NULL;
 }
 
@@ -144,53 +289,311 @@ int final_kv_cmp(struct final_kv *a, struct final_kv *b) {
 }
 
 // -----------------------------
-// EXECUTE MAPREDUCE
+// PHASES
 // -----------------------------
-int mr_exec(const struct mr_input *input, void (*map)(const struct mr_in_kv *),
-            size_t mapper_count, void (*reduce)(const struct mr_out_kv *),
-            size_t reducer_count, struct mr_output *output) {
-
-  init_intermediate();
-  intermediate_count = 0;
-
-  // -------------------------
-  // MAP PHASE
-  // -------------------------
+static void map_phase(const struct mr_input *parts, size_t part_count,
+                      void (*map)(const struct mr_in_kv *),
+                      size_t mapper_count, struct kv_buf *bufs) {
   pthread_t mthreads[mapper_count];
   struct map_args margs[mapper_count];
-  size_t chunk_size = (input->count + mapper_count - 1) / mapper_count;
+  size_t count = 0;
+  for (size_t p = 0; p < part_count; p++)
+    count += parts[p].count;
+  size_t chunk_size = (count + mapper_count - 1) / mapper_count;
 
   for (size_t t = 0; t < mapper_count; t++) {
-    margs[t].input = input->kv_lst;
+    margs[t].parts = parts;
+    margs[t].part_count = part_count;
     margs[t].start = t * chunk_size;
     margs[t].end = (t + 1) * chunk_size;
-    if (margs[t].end > input->count)
-      margs[t].end = input->count;
+    if (margs[t].end > count)
+      margs[t].end = count;
+    if (margs[t].start > margs[t].end)
+      margs[t].start = margs[t].end;
     margs[t].map = map;
+    margs[t].buf = bufs ? &bufs[t] : NULL;
     pthread_create(&mthreads[t], NULL, map_thread, &margs[t]);
   }
 
   for (size_t t = 0; t < mapper_count; t++)
     pthread_join(mthreads[t], NULL);
+}
 
-  // -------------------------
-  // REDUCE PHASE
-  // -------------------------
+// Maps whole splits, one buffer per split, checkpointing each split
+static int split_phase(const struct mr_input *input, const char *dir,
+                       void (*map)(const struct mr_in_kv *),
+                       size_t mapper_count, struct kv_buf *bufs,
+                       size_t split_count) {
+  pthread_t mthreads[mapper_count];
+  struct split_args sargs[mapper_count];
+  size_t chunk_size = (split_count + mapper_count - 1) / mapper_count;
+
+  for (size_t t = 0; t < mapper_count; t++) {
+    sargs[t].input = input;
+    sargs[t].dir = dir;
+    sargs[t].start = t * chunk_size;
+    sargs[t].end = (t + 1) * chunk_size;
+    if (sargs[t].end > split_count)
+      sargs[t].end = split_count;
+    if (sargs[t].start > sargs[t].end)
+      sargs[t].start = sargs[t].end;
+    sargs[t].map = map;
+    sargs[t].bufs = bufs;
+    sargs[t].status = 0;
+    pthread_create(&mthreads[t], NULL, split_thread, &sargs[t]);
+  }
+
+  int status = 0;
+  for (size_t t = 0; t < mapper_count; t++) {
+    pthread_join(mthreads[t], NULL);
+    if (sargs[t].status != 0)
+      status = -1;
+  }
+  return status;
+}
+
+static int reduce_phase(const struct mr_out_kv *groups, size_t group_count,
+                        void (*reduce)(const struct mr_out_kv *),
+                        size_t reducer_count, struct kv_buf *bufs,
+                        const char *dir) {
   pthread_t rthreads[reducer_count];
   struct reduce_args rargs[reducer_count];
-  size_t rchunk = (intermediate_count + reducer_count - 1) / reducer_count;
+  size_t rchunk = (group_count + reducer_count - 1) / reducer_count;
 
   for (size_t t = 0; t < reducer_count; t++) {
+    rargs[t].groups = groups;
     rargs[t].start = t * rchunk;
     rargs[t].end = (t + 1) * rchunk;
-    if (rargs[t].end > intermediate_count)
-      rargs[t].end = intermediate_count;
+    if (rargs[t].end > group_count)
+      rargs[t].end = group_count;
+    if (rargs[t].start > rargs[t].end)
+      rargs[t].start = rargs[t].end;
     rargs[t].reduce = reduce;
+    rargs[t].buf = bufs ? &bufs[t] : NULL;
+    rargs[t].dir = bufs ? dir : NULL;
+    rargs[t].partition = t;
+    rargs[t].status = 0;
     pthread_create(&rthreads[t], NULL, reduce_thread, &rargs[t]);
   }
 
-  for (size_t t = 0; t < reducer_count; t++)
+  int status = 0;
+  for (size_t t = 0; t < reducer_count; t++) {
     pthread_join(rthreads[t], NULL);
+    if (rargs[t].status != 0)
+      status = -1;
+  }
+  return status;
+}
+
+// -----------------------------
+// RADIX SHUFFLE
+// -----------------------------
+
+// Sorts and groups the records of bufs, then frees the buffers
+// On success *values holds the storage the groups point into
+static struct mr_out_kv *shuffle_bufs(struct kv_buf *bufs, size_t buf_count,
+                                      size_t thread_count,
+                                      char (**values)[MAX_VALUE_SIZE],
+                                      size_t *group_count) {
+  size_t total = 0;
+  for (size_t t = 0; t < buf_count; t++)
+    total += bufs[t].count;
+
+  struct mr_in_kv *sorted = malloc(sizeof(struct mr_in_kv) * (total + 1));
+  *values = malloc(sizeof(char[MAX_VALUE_SIZE]) * (total + 1));
+  struct mr_out_kv *groups = NULL;
+  if (sorted && *values &&
+      radix_sort(bufs, buf_count, sorted, thread_count) == 0)
+    groups = radix_group(sorted, total, *values, group_count);
+
+  for (size_t t = 0; t < buf_count; t++)
+    kv_buf_free(&bufs[t]);
+  free(sorted);
+  if (!groups) {
+    free(*values);
+    *values = NULL;
+  }
+  return groups;
+}
+
+// Runs map, radix shuffle and reduce over the input partitions
+// Leaves the final pairs of reducer t unsorted in rbufs[t]
+// With dir set, the single input partition is mapped in checkpointed splits
+static int run_stage(const struct mr_input *parts, size_t part_count,
+                     void (*map)(const struct mr_in_kv *), size_t mapper_count,
+                     void (*reduce)(const struct mr_out_kv *),
+                     size_t reducer_count, const char *dir,
+                     struct kv_buf *rbufs) {
+  // Mappers append to their own buffer: no lookup and no lock per emit
+  // When checkpointing, each split gets a buffer so it can be saved whole
+  size_t buf_count = mapper_count;
+  if (dir) {
+    if (ckpt_begin(dir, parts, reducer_count) != 0)
+      return -1;
+    buf_count = (parts->count + MR_SPLIT_SIZE - 1) / MR_SPLIT_SIZE;
+  }
+  struct kv_buf *mbufs = calloc(buf_count + 1, sizeof(struct kv_buf));
+  if (!mbufs)
+    return -1;
+  int status = 0;
+  if (dir)
+    status = split_phase(parts, dir, map, mapper_count, mbufs, buf_count);
+  else
+    map_phase(parts, part_count, map, mapper_count, mbufs);
+
+  char(*ivalues)[MAX_VALUE_SIZE];
+  size_t igroup_count;
+  size_t threads = mapper_count > reducer_count ? mapper_count : reducer_count;
+  struct mr_out_kv *igroups =
+      shuffle_bufs(mbufs, buf_count, threads, &ivalues, &igroup_count);
+  free(mbufs);
+  if (!igroups)
+    return -1;
+
+  // Groups come out of the sort in key order, so every run of the same job
+  // gives each reducer the same partition
+  if (reduce_phase(igroups, igroup_count, reduce, reducer_count, rbufs, dir) !=
+      0)
+    status = -1;
+  free(igroups);
+  free(ivalues);
+  return status;
+}
+
+// Sorts the final pairs of rbufs into output, then frees the buffers
+static int write_output(struct kv_buf *rbufs, size_t reducer_count,
+                        struct mr_output *output) {
+  // The final pairs go through the same sort, so they come out in key order
+  char(*fvalues)[MAX_VALUE_SIZE];
+  size_t fgroup_count;
+  struct mr_out_kv *fgroups = shuffle_bufs(rbufs, reducer_count, reducer_count,
+                                           &fvalues, &fgroup_count);
+  if (!fgroups)
+    return -1;
+
+  output->kv_lst = malloc(sizeof(struct mr_out_kv) * (fgroup_count + 1));
+  if (!output->kv_lst) {
+    free(fgroups);
+    free(fvalues);
+    return -1;
+  }
+  for (size_t i = 0; i < fgroup_count; i++) {
+    struct mr_out_kv *out = &output->kv_lst[i];
+    strcpy(out->key, fgroups[i].key);
+    out->count = fgroups[i].count;
+    out->value = malloc(sizeof(char[MAX_VALUE_SIZE]) * fgroups[i].count);
+    memcpy(out->value, fgroups[i].value,
+           sizeof(char[MAX_VALUE_SIZE]) * fgroups[i].count);
+    output->count++;
+  }
+  free(fgroups);
+  free(fvalues);
+  return 0;
+}
+
+static int radix_exec(const struct mr_input *input,
+                      void (*map)(const struct mr_in_kv *),
+                      size_t mapper_count,
+                      void (*reduce)(const struct mr_out_kv *),
+                      size_t reducer_count, struct mr_output *output) {
+  output->kv_lst = NULL;
+  output->count = 0;
+
+  struct kv_buf rbufs[reducer_count];
+  memset(rbufs, 0, sizeof(rbufs));
+  if (run_stage(input, 1, map, mapper_count, reduce, reducer_count, ckpt_dir,
+                rbufs) != 0) {
+    for (size_t t = 0; t < reducer_count; t++)
+      kv_buf_free(&rbufs[t]);
+    return -1;
+  }
+  if (write_output(rbufs, reducer_count, output) != 0)
+    return -1;
+  if (ckpt_dir)
+    ckpt_end(ckpt_dir);
+  return 0;
+}
+
+// -----------------------------
+// PIPELINES
+// -----------------------------
+int mr_pipeline(const struct mr_input *input, const struct mr_stage *stages,
+                size_t stage_count, struct mr_output *output) {
+  output->kv_lst = NULL;
+  output->count = 0;
+  if (stage_count == 0)
+    return -1;
+
+  // The final pairs of one stage stay in its reducers' buffers and are
+  // mapped from there by the next stage
+  const struct mr_input *parts = input;
+  size_t part_count = 1;
+  struct kv_buf *prev = NULL;
+  size_t prev_count = 0; // buffers in prev
+  struct mr_input *prev_parts = NULL;
+  int status = 0;
+
+  for (size_t s = 0; s < stage_count && status == 0; s++) {
+    const struct mr_stage *stage = &stages[s];
+    struct kv_buf *rbufs = calloc(stage->reducer_count, sizeof(struct kv_buf));
+    struct mr_input *rparts =
+        calloc(stage->reducer_count, sizeof(struct mr_input));
+    if (!rbufs || !rparts ||
+        run_stage(parts, part_count, stage->map, stage->mapper_count,
+                  stage->reduce, stage->reducer_count, NULL, rbufs) != 0)
+      status = -1;
+
+    for (size_t t = 0; prev && t < prev_count; t++)
+      kv_buf_free(&prev[t]);
+    free(prev);
+    free(prev_parts);
+    prev = rbufs;
+    prev_count = stage->reducer_count;
+    prev_parts = rparts;
+    if (status != 0)
+      break;
+
+    for (size_t t = 0; t < stage->reducer_count; t++) {
+      rparts[t].kv_lst = rbufs[t].kv_lst;
+      rparts[t].count = rbufs[t].count;
+    }
+    parts = rparts;
+    part_count = stage->reducer_count;
+  }
+
+  if (status == 0)
+    status = write_output(prev, prev_count, output);
+  else
+    for (size_t t = 0; prev && t < prev_count; t++)
+      kv_buf_free(&prev[t]);
+  free(prev);
+  free(prev_parts);
+  return status;
+}
+
+// -----------------------------
+// EXECUTE MAPREDUCE
+// -----------------------------
+int mr_exec(const struct mr_input *input, void (*map)(const struct mr_in_kv *),
+            size_t mapper_count, void (*reduce)(const struct mr_out_kv *),
+            size_t reducer_count, struct mr_output *output) {
+
+  if (shuffle == MR_SHUFFLE_RADIX || ckpt_dir)
+    return radix_exec(input, map, mapper_count, reduce, reducer_count, output);
+
+  init_intermediate();
+  intermediate_count = 0;
+
+  // -------------------------
+  // MAP PHASE
+  // -------------------------
+  map_phase(input, 1, map, mapper_count, NULL);
+
+  // -------------------------
+  // REDUCE PHASE
+  // -------------------------
+  reduce_phase(intermediate, intermediate_count, reduce, reducer_count, NULL,
+               NULL);
 
   // -------------------------
   // WRITE FINAL OUTPUT
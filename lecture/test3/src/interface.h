@@ -5,6 +5,12 @@
 #define MAX_KEY_SIZE 16
 #define MAX_VALUE_SIZE 16
 
+// Shuffle strategies for grouping the intermediate key-value pairs
+enum mr_shuffle {
+  MR_SHUFFLE_HASH, // group on every mr_emit_i (default)
+  MR_SHUFFLE_RADIX // buffer per thread, group with a parallel radix sort
+};
+
 // Used for input
 struct mr_input {
   struct mr_in_kv *kv_lst; // input key-value pairs (array)
@@ -30,6 +36,14 @@ struct mr_output {
   size_t count;             // number of final key-value pairs
 };
 
+// Used for one stage of a pipeline
+struct mr_stage {
+  void (*map)(const struct mr_in_kv *);     // map function
+  size_t mapper_count;                      // number of mappers (threads)
+  void (*reduce)(const struct mr_out_kv *); // reduce function
+  size_t reducer_count;                     // number of reducers (threads)
+};
+
 // Executes the map-reduce framework
 // Blocks until the map-reduce framework is done
 // Returns 0 on success, -1 on failure
@@ -41,6 +55,39 @@ int mr_exec(const struct mr_input *input,         // input key-value pairs
             struct mr_output *output // pointer to a final output buffer
 );
 
+// Executes the stages one after another, each mapping the final key-value
+// pairs of the one before it; the first stage maps input
+// Pairs between stages stay in the reducers' buffers, nothing is grouped or
+// copied into an mr_output until the last stage
+// Every stage groups with MR_SHUFFLE_RADIX and is not checkpointed
+// Blocks until the last stage is done
+// Returns 0 on success, -1 on failure
+int mr_pipeline(const struct mr_input *input,  // input key-value pairs
+                const struct mr_stage *stages, // stages (array)
+                size_t stage_count,            // number of stages
+                struct mr_output *output       // pointer to a final output buffer
+);
+
+// Sets the shuffle strategy used by the following mr_exec calls
+// With MR_SHUFFLE_RADIX the reduce function sees the keys in sorted order and
+// each key's values in mapper order
+// Returns the previous strategy
+enum mr_shuffle mr_shuffleopt(enum mr_shuffle);
+
+// Sets the order of the values the reduce function sees for each key
+// cmp compares two value strings like strcmp; the sort is stable
+// NULL (the default) keeps the order the values were emitted in
+void mr_sortopt(int (*cmp)(const char *, const char *));
+
+// Sets the directory where mr_exec checkpoints its completed map splits and
+// reduce partitions; NULL (the default) turns checkpointing off
+// A run of the same input that finds checkpoints there resumes from them,
+// and they are removed once the job finishes
+// Checkpointed runs group with MR_SHUFFLE_RADIX, so the map and reduce
+// functions must give the same output for the same input
+// Returns 0 on success, -1 on failure
+int mr_checkpointopt(const char *dir);
+
 // Called from the map function for the intermediate output
 // To emit one intermediate key-value pair
 // Can be called multiple times within the same map function
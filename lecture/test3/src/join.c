@@ -0,0 +1,294 @@
+#include "join.h"
+#include "uthash.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------
+// GROUPING
+// -----------------------------
+static void join_map(const struct mr_in_kv *kv) {
+  mr_emit_i(kv->key, kv->value);
+}
+
+static void group_reduce(const struct mr_out_kv *kv) {
+  for (size_t i = 0; i < kv->count; i++) {
+    mr_emit_f(kv->key, kv->value[i]);
+  }
+}
+
+// Groups input by key with the parallel shuffle, in key order
+static int group_side(const struct mr_input *input, size_t mapper_count,
+                      size_t reducer_count, struct mr_output *groups) {
+  return mr_exec(input, join_map, mapper_count, group_reduce, reducer_count,
+                 groups);
+}
+
+static void free_groups(struct mr_output *groups) {
+  for (size_t i = 0; i < groups->count; i++) {
+    free(groups->kv_lst[i].value);
+  }
+  free(groups->kv_lst);
+  groups->kv_lst = NULL;
+  groups->count = 0;
+}
+
+// -----------------------------
+// BUILD SIDE INDEX
+// -----------------------------
+struct join_entry {
+  const struct mr_out_kv *kv;
+  UT_hash_handle hh;
+};
+
+struct join_index {
+  enum mr_join alg;
+  struct mr_output groups;    // build side grouped by key, in key order
+  struct join_entry *entries; // storage for the hash table entries
+  struct join_entry *table;   // key -> group, MR_JOIN_HASH only
+};
+
+static int index_build(struct join_index *index, const struct mr_input *input,
+                       enum mr_join alg, size_t mapper_count,
+                       size_t reducer_count) {
+  index->alg = alg;
+  index->entries = NULL;
+  index->table = NULL;
+  if (group_side(input, mapper_count, reducer_count, &index->groups) != 0)
+    return -1;
+  if (alg != MR_JOIN_HASH)
+    return 0;
+
+  index->entries =
+      malloc(sizeof(struct join_entry) * (index->groups.count + 1));
+  if (!index->entries) {
+    free_groups(&index->groups);
+    return -1;
+  }
+  for (size_t i = 0; i < index->groups.count; i++) {
+    struct join_entry *entry = &index->entries[i];
+    entry->kv = &index->groups.kv_lst[i];
+    HASH_ADD_KEYPTR(hh, index->table, entry->kv->key, strlen(entry->kv->key),
+                    entry);
+  }
+  return 0;
+}
+
+static void index_free(struct join_index *index) {
+  HASH_CLEAR(hh, index->table);
+  free(index->entries);
+  index->entries = NULL;
+  free_groups(&index->groups);
+}
+
+// Index of the first group whose key is not less than key
+static size_t lower_bound(const struct mr_output *groups, const char *key) {
+  size_t lo = 0;
+  size_t hi = groups->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strcmp(groups->kv_lst[mid].key, key) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Lookups only read the index, so any number of threads can probe it
+static const struct mr_out_kv *index_find(const struct join_index *index,
+                                          const char *key) {
+  if (index->alg == MR_JOIN_HASH) {
+    struct join_entry *entry = NULL;
+    HASH_FIND_STR(index->table, key, entry);
+    return entry ? entry->kv : NULL;
+  }
+  size_t i = lower_bound(&index->groups, key);
+  if (i < index->groups.count && strcmp(index->groups.kv_lst[i].key, key) == 0)
+    return &index->groups.kv_lst[i];
+  return NULL;
+}
+
+// -----------------------------
+// BROADCAST JOIN
+// -----------------------------
+static struct join_index bcast; // small side, read by mappers and reducers
+static bool bcast_left;         // the small side is the left input
+
+static void bcast_map(const struct mr_in_kv *kv) {
+  // Pairs without a partner never reach the shuffle
+  if (index_find(&bcast, kv->key))
+    mr_emit_i(kv->key, kv->value);
+}
+
+static void bcast_reduce(const struct mr_out_kv *kv) {
+  const struct mr_out_kv *small = index_find(&bcast, kv->key);
+  // One reducer owns the key, so its pairs stay adjacent in the output
+  for (size_t i = 0; i < kv->count; i++) {
+    for (size_t j = 0; j < small->count; j++) {
+      mr_emit_f(kv->key, bcast_left ? small->value[j] : kv->value[i]);
+      mr_emit_f(kv->key, bcast_left ? kv->value[i] : small->value[j]);
+    }
+  }
+}
+
+static int broadcast_join(const struct mr_input *left,
+                          const struct mr_input *right, enum mr_join alg,
+                          size_t mapper_count, size_t reducer_count,
+                          struct mr_output *output) {
+  bcast_left = left->count <= right->count;
+  const struct mr_input *small = bcast_left ? left : right;
+  const struct mr_input *big = bcast_left ? right : left;
+
+  if (index_build(&bcast, small, alg, mapper_count, reducer_count) != 0)
+    return -1;
+  int status =
+      mr_exec(big, bcast_map, mapper_count, bcast_reduce, reducer_count, output);
+  index_free(&bcast);
+  return status;
+}
+
+// -----------------------------
+// PARTITIONED JOIN
+// -----------------------------
+struct probe_args {
+  const struct mr_output *probe;   // left side grouped by key
+  const struct join_index *build;  // right side
+  size_t start;                    // first probe group
+  size_t end;                      // one past the last probe group
+  struct mr_out_kv *out;           // joined groups
+  size_t count;                    // number of joined groups
+  int status;
+};
+
+static void join_pair(struct probe_args *args, const struct mr_out_kv *l,
+                      const struct mr_out_kv *r) {
+  struct mr_out_kv *out = &args->out[args->count];
+  out->value = malloc(sizeof(char[MAX_VALUE_SIZE]) * 2 * l->count * r->count);
+  if (!out->value) {
+    args->status = -1;
+    return;
+  }
+  strcpy(out->key, l->key);
+  out->count = 0;
+  for (size_t i = 0; i < l->count; i++) {
+    for (size_t j = 0; j < r->count; j++) {
+      memcpy(out->value[out->count++], l->value[i], MAX_VALUE_SIZE);
+      memcpy(out->value[out->count++], r->value[j], MAX_VALUE_SIZE);
+    }
+  }
+  args->count++;
+}
+
+static void *probe_thread(void *arg) {
+  struct probe_args *args = arg;
+  const struct mr_out_kv *left = args->probe->kv_lst;
+  const struct mr_output *right = &args->build->groups;
+
+  if (args->build->alg == MR_JOIN_HASH) {
+    for (size_t i = args->start; i < args->end && args->status == 0; i++) {
+      const struct mr_out_kv *r = index_find(args->build, left[i].key);
+      if (r)
+        join_pair(args, &left[i], r);
+    }
+    return NULL;
+  }
+
+  // Both sides are in key order: find where this range starts on the right,
+  // then walk the two sides together
+  size_t i = args->start;
+  size_t j = i < args->end ? lower_bound(right, left[i].key) : right->count;
+  while (i < args->end && j < right->count && args->status == 0) {
+    int cmp = strcmp(left[i].key, right->kv_lst[j].key);
+    if (cmp < 0) {
+      i++;
+    } else if (cmp > 0) {
+      j++;
+    } else {
+      join_pair(args, &left[i++], &right->kv_lst[j++]);
+    }
+  }
+  return NULL;
+}
+
+static int partitioned_join(const struct mr_input *left,
+                            const struct mr_input *right, enum mr_join alg,
+                            size_t mapper_count, size_t reducer_count,
+                            struct mr_output *output) {
+  struct mr_output probe;
+  struct join_index build;
+  if (group_side(left, mapper_count, reducer_count, &probe) != 0)
+    return -1;
+  if (index_build(&build, right, alg, mapper_count, reducer_count) != 0) {
+    free_groups(&probe);
+    return -1;
+  }
+
+  // Each thread joins a contiguous key range, so concatenating their
+  // results keeps the output in key order
+  pthread_t threads[reducer_count];
+  struct probe_args args[reducer_count];
+  size_t chunk = (probe.count + reducer_count - 1) / reducer_count;
+  for (size_t t = 0; t < reducer_count; t++) {
+    args[t].probe = &probe;
+    args[t].build = &build;
+    args[t].start = t * chunk < probe.count ? t * chunk : probe.count;
+    args[t].end = (t + 1) * chunk < probe.count ? (t + 1) * chunk : probe.count;
+    args[t].out =
+        malloc(sizeof(struct mr_out_kv) * (args[t].end - args[t].start + 1));
+    args[t].count = 0;
+    args[t].status = args[t].out ? 0 : -1;
+    pthread_create(&threads[t], NULL, probe_thread, &args[t]);
+  }
+
+  size_t total = 0;
+  int status = 0;
+  for (size_t t = 0; t < reducer_count; t++) {
+    pthread_join(threads[t], NULL);
+    total += args[t].count;
+    if (args[t].status != 0)
+      status = -1;
+  }
+
+  output->kv_lst = malloc(sizeof(struct mr_out_kv) * (total + 1));
+  if (!output->kv_lst)
+    status = -1;
+  for (size_t t = 0; t < reducer_count; t++) {
+    for (size_t i = 0; i < args[t].count; i++) {
+      if (status == 0)
+        output->kv_lst[output->count++] = args[t].out[i];
+      else
+        free(args[t].out[i].value);
+    }
+    free(args[t].out);
+  }
+  if (status != 0)
+    free_groups(output);
+
+  index_free(&build);
+  free_groups(&probe);
+  return status;
+}
+
+// -----------------------------
+// JOIN
+// -----------------------------
+int mr_join(const struct mr_input *left, const struct mr_input *right,
+            enum mr_join alg, size_t mapper_count, size_t reducer_count,
+            struct mr_output *output) {
+  output->kv_lst = NULL;
+  output->count = 0;
+
+  // The radix shuffle keeps each key's pairs together and in key order
+  enum mr_shuffle old = mr_shuffleopt(MR_SHUFFLE_RADIX);
+  int status;
+  if (left->count <= MR_BROADCAST_LIMIT || right->count <= MR_BROADCAST_LIMIT)
+    status = broadcast_join(left, right, alg, mapper_count, reducer_count,
+                            output);
+  else
+    status = partitioned_join(left, right, alg, mapper_count, reducer_count,
+                              output);
+  mr_shuffleopt(old);
+  return status;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "interface.h"
+
+// Sides with at most this many pairs are broadcast to every reducer
+// instead of being shuffled
+#define MR_BROADCAST_LIMIT 256
+
+// Join algorithms
+enum mr_join {
+  MR_JOIN_HASH,      // build a hash table on one side, probe with the other
+  MR_JOIN_SORT_MERGE // merge the two key-sorted sides
+};
+
+// Joins left and right on key
+// Every key found on both sides appears once in the output, in key order
+// Its values are the matching pairs flattened: value[2 * i] comes from left
+// and value[2 * i + 1] from right, one pair per left/right combination
+// Uses a broadcast join when one side is small and a partitioned join
+// otherwise, both on top of mr_exec with MR_SHUFFLE_RADIX
+// Not reentrant: only one join can run at a time
+// Returns 0 on success, -1 on failure
+int mr_join(const struct mr_input *left,  // left key-value pairs
+            const struct mr_input *right, // right key-value pairs
+            enum mr_join alg,             // join algorithm
+            size_t mapper_count,          // number of mappers (threads)
+            size_t reducer_count,         // number of reducers (threads)
+            struct mr_output *output      // pointer to a final output buffer
+);
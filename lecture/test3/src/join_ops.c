@@ -0,0 +1,84 @@
+#include "interface.h"
+#include "join.h"
+#include "tests.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LEFT_MOD 50
+#define RIGHT_MOD 70
+
+struct mr_in_kv jo_left_lst[MAX_DATA_SIZE];
+struct mr_in_kv jo_right_lst[MAX_DATA_SIZE];
+
+// Number of records of a side whose index maps to key k
+size_t jo_side_count(size_t count, size_t mod, size_t k) {
+  return k < mod ? (count - k + mod - 1) / mod : 0;
+}
+
+// Checks the output against the cross product of the two sides
+int jo_cmp(struct mr_output *output, size_t left_count, size_t right_count) {
+  size_t keys = 0;
+  for (size_t k = 0; k < LEFT_MOD; k++) {
+    if (jo_side_count(left_count, LEFT_MOD, k) > 0 &&
+        jo_side_count(right_count, RIGHT_MOD, k) > 0)
+      keys++;
+  }
+  if (output->count != keys)
+    return -1;
+
+  for (size_t i = 0; i < output->count; i++) {
+    struct mr_out_kv *kv = &output->kv_lst[i];
+    if (i > 0 && strcmp(output->kv_lst[i - 1].key, kv->key) >= 0)
+      return -1;
+
+    size_t k = strtoul(kv->key + 1, NULL, 10);
+    size_t pairs = jo_side_count(left_count, LEFT_MOD, k) *
+                   jo_side_count(right_count, RIGHT_MOD, k);
+    if (kv->count != 2 * pairs)
+      return -1;
+
+    for (size_t p = 0; p < pairs; p++) {
+      const char *l = kv->value[2 * p];
+      const char *r = kv->value[2 * p + 1];
+      if (l[0] != 'l' || strtoul(l + 1, NULL, 10) % LEFT_MOD != k ||
+          r[0] != 'r' || strtoul(r + 1, NULL, 10) % RIGHT_MOD != k)
+        return -1;
+      for (size_t q = 0; q < p; q++) {
+        if (strcmp(kv->value[2 * q], l) == 0 &&
+            strcmp(kv->value[2 * q + 1], r) == 0)
+          return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+bool join_operators(void) {
+  for (size_t i = 0; i < MAX_DATA_SIZE; i++) {
+    snprintf(jo_left_lst[i].key, MAX_KEY_SIZE, "k%zu", i % LEFT_MOD);
+    snprintf(jo_left_lst[i].value, MAX_VALUE_SIZE, "l%zu", i);
+    snprintf(jo_right_lst[i].key, MAX_KEY_SIZE, "k%zu", i % RIGHT_MOD);
+    snprintf(jo_right_lst[i].value, MAX_VALUE_SIZE, "r%zu", i);
+  }
+
+  // Small right side (broadcast), small left side (broadcast), both large
+  size_t sizes[3][2] = {{600, 100}, {100, 600}, {600, 500}};
+  struct mr_output output;
+
+  bool res = true;
+  for (size_t alg = 0; alg < 2; alg++) {
+    for (size_t s = 0; s < 3; s++) {
+      struct mr_input left = {jo_left_lst, sizes[s][0]};
+      struct mr_input right = {jo_right_lst, sizes[s][1]};
+      res = res &&
+            mr_join(&left, &right, alg == 0 ? MR_JOIN_HASH : MR_JOIN_SORT_MERGE,
+                    4, 4, &output) == 0 &&
+            jo_cmp(&output, sizes[s][0], sizes[s][1]) == 0;
+      free_output(&output);
+    }
+  }
+  TEST(res, 5);
+
+  return res;
+}
@@ -5,5 +5,10 @@ int main(int argc, char *argv[]) {
       number_of_mappers() && number_of_reducers() && partition_input() &&
       partition_intermediate() && full_map_reduce())
     TEST(true, 5);
+  radix_shuffle();
+  value_order();
+  checkpoint_resume();
+  join_operators();
+  pipeline_stages();
   return 0;
 }
@@ -0,0 +1,70 @@
+#include "interface.h"
+#include "tests.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+extern struct mr_in_kv ex_in_kv_lst[MAX_DATA_SIZE];
+void amr_map(const struct mr_in_kv *in_kv);
+void amr_reduce(const struct mr_out_kv *inter_kv);
+int output_cmp(struct mr_output *a, struct mr_output *b);
+
+// Second stage: groups the words by how often they appear
+void pl_count_map(const struct mr_in_kv *in_kv) {
+  char key[MAX_KEY_SIZE];
+  snprintf(key, MAX_KEY_SIZE, "%05d", atoi(in_kv->value));
+  mr_emit_i(key, in_kv->key);
+}
+
+void pl_count_reduce(const struct mr_out_kv *inter_kv) {
+  for (size_t i = 0; i < inter_kv->count; i++) {
+    mr_emit_f(inter_kv->key, inter_kv->value[i]);
+  }
+}
+
+// Flattens an output into an input for the next job
+struct mr_input pl_flatten(struct mr_output *output) {
+  size_t count = 0;
+  for (size_t i = 0; i < output->count; i++)
+    count += output->kv_lst[i].count;
+  struct mr_input input = {malloc(sizeof(struct mr_in_kv) * (count + 1)), 0};
+  for (size_t i = 0; i < output->count; i++) {
+    for (size_t j = 0; j < output->kv_lst[i].count; j++) {
+      struct mr_in_kv *kv = &input.kv_lst[input.count++];
+      snprintf(kv->key, MAX_KEY_SIZE, "%s", output->kv_lst[i].key);
+      snprintf(kv->value, MAX_VALUE_SIZE, "%s", output->kv_lst[i].value[j]);
+    }
+  }
+  return input;
+}
+
+bool pipeline_stages(void) {
+  struct mr_input input = {ex_in_kv_lst, MAX_DATA_SIZE};
+  struct mr_output first;
+  struct mr_output expected;
+  struct mr_output output;
+
+  // The same two jobs run one at a time through mr_exec
+  enum mr_shuffle old = mr_shuffleopt(MR_SHUFFLE_RADIX);
+  bool res = mr_exec(&input, amr_map, 4, amr_reduce, 4, &first) == 0;
+  struct mr_input counts = pl_flatten(&first);
+  res = res && mr_exec(&counts, pl_count_map, 3, pl_count_reduce, 2,
+                       &expected) == 0;
+  mr_shuffleopt(old);
+  free(counts.kv_lst);
+  free_output(&first);
+
+  struct mr_stage stages[] = {{amr_map, 4, amr_reduce, 4},
+                              {pl_count_map, 3, pl_count_reduce, 2}};
+  res = res && mr_pipeline(&input, stages, 2, &output) == 0 &&
+        output_cmp(&expected, &output) == 0;
+  free_output(&output);
+
+  // A one-stage pipeline is a plain job
+  res = res && mr_pipeline(&input, stages, 1, &output) == 0 &&
+        output.count > 0 && output.kv_lst[0].count == 1;
+  free_output(&output);
+  free_output(&expected);
+  TEST(res, 5);
+
+  return res;
+}
@@ -0,0 +1,237 @@
+#include "radix.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RADIX 256
+
+// -----------------------------
+// RECORD BUFFERS
+// -----------------------------
+int kv_buf_push(struct kv_buf *buf, const char *key, const char *value) {
+  if (buf->count == buf->cap) {
+    size_t cap = buf->cap ? buf->cap * 2 : 64;
+    struct mr_in_kv *kv_lst =
+        realloc(buf->kv_lst, sizeof(struct mr_in_kv) * cap);
+    if (!kv_lst)
+      return -1;
+    buf->kv_lst = kv_lst;
+    buf->cap = cap;
+  }
+  // strncpy zero pads, so the whole key can be used as a radix digit string
+  struct mr_in_kv *kv = &buf->kv_lst[buf->count++];
+  strncpy(kv->key, key, MAX_KEY_SIZE);
+  kv->key[MAX_KEY_SIZE - 1] = '\0';
+  strncpy(kv->value, value, MAX_VALUE_SIZE);
+  kv->value[MAX_VALUE_SIZE - 1] = '\0';
+  return 0;
+}
+
+void kv_buf_free(struct kv_buf *buf) {
+  free(buf->kv_lst);
+  buf->kv_lst = NULL;
+  buf->count = 0;
+  buf->cap = 0;
+}
+
+// -----------------------------
+// MSD PASS: PARTITION ON key[0]
+// -----------------------------
+struct partition_args {
+  const struct kv_buf *buf;
+  struct mr_in_kv *out;
+  size_t offset[RADIX]; // histogram, then write position per bucket
+};
+
+static void count_buf(struct partition_args *args) {
+  memset(args->offset, 0, sizeof(args->offset));
+  for (size_t i = 0; i < args->buf->count; i++) {
+    args->offset[(unsigned char)args->buf->kv_lst[i].key[0]]++;
+  }
+}
+
+static void scatter_buf(struct partition_args *args) {
+  for (size_t i = 0; i < args->buf->count; i++) {
+    const struct mr_in_kv *kv = &args->buf->kv_lst[i];
+    args->out[args->offset[(unsigned char)kv->key[0]]++] = *kv;
+  }
+}
+
+// Runs one of the passes above over a contiguous range of buffers
+struct pass_args {
+  struct partition_args *pargs;
+  size_t start;
+  size_t end;
+  void (*pass)(struct partition_args *);
+};
+
+static void *pass_thread(void *arg) {
+  struct pass_args *args = arg;
+  for (size_t i = args->start; i < args->end; i++) {
+    args->pass(&args->pargs[i]);
+  }
+  return NULL;
+}
+
+static void run_pass(struct partition_args *pargs, size_t buf_count,
+                     size_t thread_count,
+                     void (*pass)(struct partition_args *)) {
+  if (thread_count > buf_count)
+    thread_count = buf_count;
+  pthread_t threads[thread_count];
+  struct pass_args args[thread_count];
+  size_t chunk = (buf_count + thread_count - 1) / thread_count;
+
+  for (size_t t = 0; t < thread_count; t++) {
+    args[t].pargs = pargs;
+    args[t].start = t * chunk < buf_count ? t * chunk : buf_count;
+    args[t].end = (t + 1) * chunk < buf_count ? (t + 1) * chunk : buf_count;
+    args[t].pass = pass;
+    pthread_create(&threads[t], NULL, pass_thread, &args[t]);
+  }
+  for (size_t t = 0; t < thread_count; t++)
+    pthread_join(threads[t], NULL);
+}
+
+// -----------------------------
+// LSD PASSES: SORT ONE BUCKET ON key[1..]
+// -----------------------------
+static void lsd_sort(struct mr_in_kv *kv_lst, struct mr_in_kv *tmp,
+                     size_t count) {
+  size_t hist[MAX_KEY_SIZE][RADIX] = {{0}};
+
+  // Digit counts do not change between passes, so take them all at once
+  for (size_t i = 0; i < count; i++) {
+    for (size_t d = 1; d < MAX_KEY_SIZE; d++) {
+      hist[d][(unsigned char)kv_lst[i].key[d]]++;
+    }
+  }
+
+  struct mr_in_kv *src = kv_lst;
+  struct mr_in_kv *dst = tmp;
+  for (size_t d = MAX_KEY_SIZE - 1; d >= 1; d--) {
+    // Skip digits shared by every key (e.g. the zero padding)
+    if (hist[d][(unsigned char)src[0].key[d]] == count)
+      continue;
+
+    size_t offset[RADIX];
+    size_t sum = 0;
+    for (size_t b = 0; b < RADIX; b++) {
+      offset[b] = sum;
+      sum += hist[d][b];
+    }
+    for (size_t i = 0; i < count; i++) {
+      dst[offset[(unsigned char)src[i].key[d]]++] = src[i];
+    }
+
+    struct mr_in_kv *swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != kv_lst)
+    memcpy(kv_lst, src, sizeof(struct mr_in_kv) * count);
+}
+
+struct bucket_args {
+  struct mr_in_kv *out;
+  struct mr_in_kv *tmp;
+  const size_t *start; // RADIX + 1 bucket boundaries
+  atomic_size_t *next; // next bucket to sort
+};
+
+static void *bucket_thread(void *arg) {
+  struct bucket_args *args = arg;
+  size_t b;
+  while ((b = atomic_fetch_add(args->next, 1)) < RADIX) {
+    size_t count = args->start[b + 1] - args->start[b];
+    if (count > 1)
+      lsd_sort(args->out + args->start[b], args->tmp + args->start[b], count);
+  }
+  return NULL;
+}
+
+// -----------------------------
+// PARALLEL RADIX SORT
+// -----------------------------
+int radix_sort(const struct kv_buf *bufs, size_t buf_count,
+               struct mr_in_kv *out, size_t thread_count) {
+  size_t total = 0;
+  for (size_t i = 0; i < buf_count; i++)
+    total += bufs[i].count;
+  if (total == 0)
+    return 0;
+  if (thread_count == 0)
+    thread_count = 1;
+
+  struct partition_args *pargs = malloc(sizeof(*pargs) * buf_count);
+  struct mr_in_kv *tmp = malloc(sizeof(struct mr_in_kv) * total);
+  if (!pargs || !tmp) {
+    free(pargs);
+    free(tmp);
+    return -1;
+  }
+
+  // Per-buffer histograms of the first key byte
+  for (size_t t = 0; t < buf_count; t++) {
+    pargs[t].buf = &bufs[t];
+    pargs[t].out = out;
+  }
+  run_pass(pargs, buf_count, thread_count, count_buf);
+
+  // Bucket-major, buffer-minor offsets keep the partition stable
+  size_t start[RADIX + 1];
+  size_t sum = 0;
+  for (size_t b = 0; b < RADIX; b++) {
+    start[b] = sum;
+    for (size_t t = 0; t < buf_count; t++) {
+      size_t count = pargs[t].offset[b];
+      pargs[t].offset[b] = sum;
+      sum += count;
+    }
+  }
+  start[RADIX] = sum;
+
+  run_pass(pargs, buf_count, thread_count, scatter_buf);
+
+  // Buckets are independent, hand them out to the sorting threads
+  atomic_size_t next = 0;
+  pthread_t bthreads[thread_count];
+  struct bucket_args bargs = {out, tmp, start, &next};
+  for (size_t t = 0; t < thread_count; t++)
+    pthread_create(&bthreads[t], NULL, bucket_thread, &bargs);
+  for (size_t t = 0; t < thread_count; t++)
+    pthread_join(bthreads[t], NULL);
+
+  free(pargs);
+  free(tmp);
+  return 0;
+}
+
+// -----------------------------
+// GROUP EQUAL KEYS
+// -----------------------------
+struct mr_out_kv *radix_group(const struct mr_in_kv *sorted, size_t count,
+                              char (*values)[MAX_VALUE_SIZE],
+                              size_t *group_count) {
+  struct mr_out_kv *groups =
+      malloc(sizeof(struct mr_out_kv) * (count ? count : 1));
+  if (!groups)
+    return NULL;
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    memcpy(values[i], sorted[i].value, MAX_VALUE_SIZE);
+    if (i == 0 ||
+        memcmp(sorted[i].key, sorted[i - 1].key, MAX_KEY_SIZE) != 0) {
+      memcpy(groups[n].key, sorted[i].key, MAX_KEY_SIZE);
+      groups[n].value = &values[i];
+      groups[n].count = 0;
+      n++;
+    }
+    groups[n - 1].count++;
+  }
+  *group_count = n;
+  return groups;
+}
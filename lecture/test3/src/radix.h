@@ -0,0 +1,35 @@
+#pragma once
+
+#include "interface.h"
+#include <stddef.h>
+
+// Growable array of key-value records
+// Each map/reduce thread owns one, so appending needs no lock
+struct kv_buf {
+  struct mr_in_kv *kv_lst; // records (array)
+  size_t count;            // number of records
+  size_t cap;              // allocated number of records
+};
+
+// Appends one record, zero padding the key and value
+// Returns 0 on success, -1 on failure
+int kv_buf_push(struct kv_buf *buf, const char *key, const char *value);
+
+// Frees the records and empties the buffer
+void kv_buf_free(struct kv_buf *buf);
+
+// Sorts the records of bufs[0..buf_count) by key into out
+// The sort is stable: equal keys keep buffer order, then insertion order
+// out must have room for the records of all the buffers
+// At most thread_count threads work on each pass
+// Returns 0 on success, -1 on failure
+int radix_sort(const struct kv_buf *bufs, size_t buf_count,
+               struct mr_in_kv *out, size_t thread_count);
+
+// Groups the runs of equal keys in sorted[0..count)
+// Copies the values into values (count entries) and returns one group per
+// distinct key whose value array points into values
+// Returns NULL on failure
+struct mr_out_kv *radix_group(const struct mr_in_kv *sorted, size_t count,
+                              char (*values)[MAX_VALUE_SIZE],
+                              size_t *group_count);
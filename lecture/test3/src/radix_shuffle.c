@@ -0,0 +1,63 @@
+#include "interface.h"
+#include "tests.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MOD 8
+
+extern struct mr_in_kv ex_in_kv_lst[MAX_DATA_SIZE];
+void amr_map(const struct mr_in_kv *in_kv);
+void amr_reduce(const struct mr_out_kv *inter_kv);
+int amr_cmp(struct mr_output *output);
+
+struct mr_in_kv rs_in_kv_lst[MAX_DATA_SIZE];
+bool rs_in_order = true;
+
+void rs_map(const struct mr_in_kv *in_kv) {
+  mr_emit_i(in_kv->key, in_kv->value);
+}
+
+// Values of key k must arrive as k, k + MOD, k + 2 * MOD, ...
+void rs_reduce(const struct mr_out_kv *inter_kv) {
+  size_t k = 0;
+  sscanf(inter_kv->key, "%zu", &k);
+  if (inter_kv->count != MAX_DATA_SIZE / MOD) {
+    rs_in_order = false;
+    return;
+  }
+  for (size_t i = 0; i < inter_kv->count; i++) {
+    char expected[MAX_VALUE_SIZE];
+    snprintf(expected, MAX_VALUE_SIZE, "%zu", k + i * MOD);
+    if (strcmp(inter_kv->value[i], expected) != 0)
+      rs_in_order = false;
+  }
+}
+
+bool radix_shuffle(void) {
+  for (size_t i = 0; i < MAX_DATA_SIZE; i++) {
+    snprintf(rs_in_kv_lst[i].key, MAX_KEY_SIZE, "%zu", i % MOD);
+    snprintf(rs_in_kv_lst[i].value, MAX_VALUE_SIZE, "%zu", i);
+  }
+
+  struct mr_input amr_input = {ex_in_kv_lst, MAX_DATA_SIZE};
+  struct mr_input rs_input = {rs_in_kv_lst, MAX_DATA_SIZE};
+  struct mr_output output;
+
+  mr_shuffleopt(MR_SHUFFLE_RADIX);
+  bool res = true;
+  for (size_t i = 0; i < 5; i++) {
+    size_t n = 1 << i;
+    res = res && mr_exec(&amr_input, amr_map, n, amr_reduce, n, &output) == 0 &&
+          output.count == 57 && amr_cmp(&output) == 0;
+    free_output(&output);
+
+    rs_in_order = true;
+    res = res && mr_exec(&rs_input, rs_map, n, rs_reduce, n, &output) == 0 &&
+          rs_in_order;
+    free_output(&output);
+  }
+  mr_shuffleopt(MR_SHUFFLE_HASH);
+  TEST(res, 5);
+
+  return res;
+}
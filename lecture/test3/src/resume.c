@@ -0,0 +1,131 @@
+#include "interface.h"
+#include "tests.h"
+#include <dirent.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern struct mr_in_kv ex_in_kv_lst[MAX_DATA_SIZE];
+void amr_map(const struct mr_in_kv *in_kv);
+void amr_reduce(const struct mr_out_kv *inter_kv);
+
+atomic_size_t ckpt_map_calls = 0;
+atomic_size_t ckpt_reduce_calls = 0;
+static const char *ckpt_crash_dir; // checkpoints of the crashing job
+
+// Dies part way through the map phase
+void ckpt_crash_map(const struct mr_in_kv *in_kv) {
+  if (atomic_fetch_add(&ckpt_map_calls, 1) == MAX_DATA_SIZE / 2)
+    _exit(1);
+  amr_map(in_kv);
+}
+
+// Number of reduce partitions sealed in dir
+static size_t ckpt_sealed(const char *dir) {
+  size_t count = 0;
+  DIR *d = opendir(dir);
+  for (struct dirent *ent; d && (ent = readdir(d)) != NULL;)
+    count += strncmp(ent->d_name, "reduce-", 7) == 0;
+  if (d)
+    closedir(d);
+  return count;
+}
+
+// Dies in the reducer that owns the last key, once the 3 other reducers
+// have sealed their partitions; gives up waiting after 10 seconds
+void ckpt_crash_reduce(const struct mr_out_kv *inter_kv) {
+  if (strcmp(inter_kv->key, "you") == 0) {
+    for (int i = 0; i < 10000 && ckpt_sealed(ckpt_crash_dir) < 3; i++)
+      usleep(1000);
+    _exit(1);
+  }
+  amr_reduce(inter_kv);
+}
+
+void ckpt_count_map(const struct mr_in_kv *in_kv) {
+  atomic_fetch_add(&ckpt_map_calls, 1);
+  amr_map(in_kv);
+}
+
+void ckpt_count_reduce(const struct mr_out_kv *inter_kv) {
+  atomic_fetch_add(&ckpt_reduce_calls, 1);
+  amr_reduce(inter_kv);
+}
+
+int output_cmp(struct mr_output *a, struct mr_output *b) {
+  if (a->count != b->count)
+    return -1;
+  for (size_t i = 0; i < a->count; i++) {
+    if (strcmp(a->kv_lst[i].key, b->kv_lst[i].key) != 0 ||
+        a->kv_lst[i].count != b->kv_lst[i].count)
+      return -1;
+    for (size_t j = 0; j < a->kv_lst[i].count; j++) {
+      if (strcmp(a->kv_lst[i].value[j], b->kv_lst[i].value[j]) != 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Runs one crashing job in a child process
+bool crash_child(const char *dir, void (*map)(const struct mr_in_kv *),
+                 void (*reduce)(const struct mr_out_kv *)) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    struct mr_input input = {ex_in_kv_lst, MAX_DATA_SIZE};
+    struct mr_output output;
+    ckpt_crash_dir = dir;
+    mr_checkpointopt(dir);
+    mr_exec(&input, map, 4, reduce, 4, &output);
+    _exit(0);
+  }
+  int status;
+  return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 1;
+}
+
+bool checkpoint_resume(void) {
+  char dir[] = "/tmp/mr_ckpt_XXXXXX";
+  if (!mkdtemp(dir)) {
+    TEST(false, 5);
+    return false;
+  }
+
+  struct mr_input input = {ex_in_kv_lst, MAX_DATA_SIZE};
+  struct mr_output expected;
+  struct mr_output output;
+
+  mr_shuffleopt(MR_SHUFFLE_RADIX);
+  bool res = mr_exec(&input, amr_map, 4, amr_reduce, 4, &expected) == 0;
+  mr_shuffleopt(MR_SHUFFLE_HASH);
+
+  // Killed in the map phase: the resumed run skips the saved splits
+  res = res && crash_child(dir, ckpt_crash_map, amr_reduce);
+  mr_checkpointopt(dir);
+  ckpt_map_calls = 0;
+  res = res &&
+        mr_exec(&input, ckpt_count_map, 4, amr_reduce, 4, &output) == 0 &&
+        ckpt_map_calls < MAX_DATA_SIZE && output_cmp(&expected, &output) == 0;
+  free_output(&output);
+
+  // Killed in the reduce phase: the resumed run skips the sealed partitions
+  res = res && crash_child(dir, amr_map, ckpt_crash_reduce);
+  ckpt_map_calls = 0;
+  ckpt_reduce_calls = 0;
+  res = res &&
+        mr_exec(&input, ckpt_count_map, 4, ckpt_count_reduce, 4, &output) ==
+            0 &&
+        ckpt_map_calls == 0 && ckpt_reduce_calls < expected.count &&
+        output_cmp(&expected, &output) == 0;
+  free_output(&output);
+  mr_checkpointopt(NULL);
+
+  free_output(&expected);
+  res = res && rmdir(dir) == 0;
+  TEST(res, 5);
+
+  return res;
+}
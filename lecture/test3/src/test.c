@@ -5,7 +5,7 @@
 #include <unistd.h>
 
 static size_t SUCCESS_CASES = 0;
-static size_t TOTAL_CASES = 25;
+static size_t TOTAL_CASES = 30;
 static size_t TOTAL_SCORE = 0;
 
 void print_test_result() {
@@ -21,4 +21,9 @@ bool partition_input(void);
 bool partition_intermediate(void);
 bool full_map_reduce(void);
 bool multiple_calls(void);
+bool radix_shuffle(void);
+bool value_order(void);
+bool checkpoint_resume(void);
+bool join_operators(void);
+bool pipeline_stages(void);
 void free_output(struct mr_output *);
@@ -0,0 +1,53 @@
+#include "interface.h"
+#include "tests.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MOD 8
+
+struct mr_in_kv vo_in_kv_lst[MAX_DATA_SIZE];
+bool vo_sorted = true;
+
+int vo_cmp(const char *a, const char *b) { return atoi(a) - atoi(b); }
+
+void vo_map(const struct mr_in_kv *in_kv) {
+  mr_emit_i(in_kv->key, in_kv->value);
+}
+
+void vo_reduce(const struct mr_out_kv *inter_kv) {
+  if (inter_kv->count != MAX_DATA_SIZE / MOD) {
+    vo_sorted = false;
+    return;
+  }
+  for (size_t i = 1; i < inter_kv->count; i++) {
+    if (vo_cmp(inter_kv->value[i - 1], inter_kv->value[i]) > 0)
+      vo_sorted = false;
+  }
+}
+
+bool value_order(void) {
+  for (size_t i = 0; i < MAX_DATA_SIZE; i++) {
+    snprintf(vo_in_kv_lst[i].key, MAX_KEY_SIZE, "%zu", i % MOD);
+    snprintf(vo_in_kv_lst[i].value, MAX_VALUE_SIZE, "%d", rand() % 10000);
+  }
+
+  struct mr_input vo_input = {vo_in_kv_lst, MAX_DATA_SIZE};
+  struct mr_output vo_output;
+
+  mr_sortopt(vo_cmp);
+  bool res = true;
+  for (size_t i = 0; i < 2; i++) {
+    mr_shuffleopt(i == 0 ? MR_SHUFFLE_HASH : MR_SHUFFLE_RADIX);
+    vo_sorted = true;
+    res = res &&
+          mr_exec(&vo_input, vo_map, 4, vo_reduce, 4, &vo_output) == 0 &&
+          vo_sorted;
+    free_output(&vo_output);
+  }
+  mr_shuffleopt(MR_SHUFFLE_HASH);
+  mr_sortopt(NULL);
+  TEST(res, 5);
+
+  return res;
+}